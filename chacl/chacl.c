@@ -24,21 +24,46 @@
 #include <libgen.h>
 #include <stdio.h>
 #include <errno.h>
-#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/acl.h>
 #include <acl/libacl.h>
 #include <locale.h>
 #include "config.h"
+#include "walk_tree.h"
+#include "inode_set.h"
+#include "misc.h"
 
 static int acl_delete_file (const char * path, acl_type_t type);
-static int list_acl(char *file);
+static int list_acl(const char *file);
 static int set_acl(acl_t acl, acl_t dacl, const char *fname);
-static int walk_dir(acl_t acl, acl_t dacl, const char *fname);
+static int walk_set_acl(const char *fname, const struct stat *st,
+			int walk_flags, void *arg);
+static int chacl_file(const char *file);
 
 static char *program;
 static int rflag;
+static int Rflag;		/* set to true to remove an acl */
+static int Dflag;		/* set to true to remove default acls */
+static int Bflag;		/* set to true to remove both acls */
+static int lflag;		/* set to true to list acls */
+static acl_t acl;		/* File ACL */
+static acl_t dacl;		/* Directory Default ACL */
+static struct inode_set *links;	/* hard linked files already done */
+
+/*
+ * Children are handled before their parent directory so that an ACL which
+ * denies search access does not prevent the recursion.
+ */
+static int walk_flags = WALK_TREE_RECURSIVE | WALK_TREE_LOGICAL |
+			WALK_TREE_DEREFERENCE | WALK_TREE_POSTORDER;
+
+static struct option long_options[] = {
+	WALK_TREE_LONG_OPTIONS,
+	{ "files-from",		1, 0, 'F' },
+	{ "null",		0, 0, '0' },
+	{ NULL,			0, 0, 0 }
+};
 
 static void
 usage(void)
@@ -54,6 +79,12 @@ usage(void)
 			program);
 	fprintf(stderr, _("\t%s -r pathname...\t[not IRIX compatible]\n"),
 			program);
+	fprintf(stderr, _("Options for -r:\n"
+		"\t--one-file-system, --exclude=PATTERN, "
+		"--exclude-from=FILE,\n"
+		"\t--type=d|f, --max-depth=N\n"));
+	fprintf(stderr, _("Options for all modes:\n"
+		"\t--files-from=FILE, -0|--null\n"));
 	exit(1);
 }
 
@@ -61,18 +92,14 @@ int
 main(int argc, char *argv[])
 {
 	char *file;
+	const char *files_from = NULL;	/* file listing further pathnames */
+	int null_separated = 0;		/* pathnames separated by '\0' */
 	int switch_flag = 0;            /* ensure only one switch is used */
 	int args_required = 2;	
 	int failed = 0;			/* exit status */
 	int c;				/* For use by getopt(3) */
 	int dflag = 0;			/* a Default ACL is desired */
 	int bflag = 0;			/* a both ACLs are desired */
-	int Rflag = 0;			/* set to true to remove an acl */
-	int Dflag = 0;			/* set to true to remove default acls */
-	int Bflag = 0;			/* set to true to remove both acls */
-	int lflag = 0;			/* set to true to list acls */
-	acl_t acl = NULL;		/* File ACL */
-	acl_t dacl = NULL;		/* Directory Default ACL */
 
 	program = basename(argv[0]);
 
@@ -82,7 +109,24 @@ main(int argc, char *argv[])
 	textdomain(PACKAGE);
 
 	/* parse arguments */
-	while ((c = getopt(argc, argv, "bdlRDBr")) != -1) {
+	while ((c = getopt_long(argc, argv, "bdlRDBr0", long_options,
+				NULL)) != -1) {
+		switch (walk_tree_option(c, optarg, &walk_flags)) {
+			case 0:
+				continue;
+			case -1:
+				fprintf(stderr, "%s: %s: %s\n",
+					program, optarg, strerror(errno));
+				exit(1);
+		}
+		if (c == 'F') {
+			files_from = optarg;
+			continue;
+		}
+		if (c == '0') {
+			null_separated = 1;
+			continue;
+		}
 		if (switch_flag) 
 			usage();
 		switch_flag = 1;
@@ -122,44 +166,16 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* the pathnames may all come from a list */
+	if (files_from)
+		args_required--;
+
 	/* if not enough arguments quit */
 	if ((argc - optind) < args_required)
 		usage();
 
-        /* list the acls */
-	if (lflag) {
-		for (; optind < argc; optind++) {	
-			file = argv[optind];
-			if (!list_acl(file))
-				failed++;
-		}
-		return(failed);
-	}
-
-	/* remove the acls */
-	if (Rflag || Dflag || Bflag) {
-		for (; optind < argc; optind++) {	
-			file = argv[optind];
-			if (!Dflag &&
-			    (acl_delete_file(file, ACL_TYPE_ACCESS) == -1)) {
-				fprintf(stderr, _(
-			"%s: error removing access acl on \"%s\": %s\n"),
-					program, file, strerror(errno));
-				failed++;
-			}
-			if (!Rflag &&
-			    (acl_delete_file(file, ACL_TYPE_DEFAULT) == -1)) {
-				fprintf(stderr, _(
-			"%s: error removing default acl on \"%s\": %s\n"),
-					program, file, strerror(errno));
-				failed++;
-			}
-		}
-		return(failed);
-	}
-
 	/* file access acl */
-	if (! dflag) { 
+	if (! (dflag || lflag || Rflag || Dflag || Bflag)) { 
 		acl = acl_from_text(argv[optind]);
 		failed = acl_check(acl, &c);
 		if (failed < 0) {
@@ -176,7 +192,6 @@ main(int argc, char *argv[])
 		optind++;
 	}
 
-
 	/* directory default acl */
 	if (bflag || dflag) {
 		dacl = acl_from_text(argv[optind]);
@@ -195,9 +210,37 @@ main(int argc, char *argv[])
 		optind++;
 	}
 
-	/* place acls on files */
+	/* list, remove, or place acls on files */
+	if (rflag)
+		links = inode_set_create(0);
 	for (; optind < argc; optind++)
-		failed += set_acl(acl, dacl, argv[optind]);
+		failed += chacl_file(argv[optind]);
+
+	/* pathnames from the list, one per line or null separated */
+	if (files_from) {
+		FILE *list = stdin;
+
+		if (strcmp(files_from, "-") != 0)
+			list = fopen(files_from, "r");
+		if (!list) {
+			fprintf(stderr, "%s: %s: %s\n",
+				program, files_from, strerror(errno));
+			failed++;
+		} else {
+			while ((file = next_name(list, null_separated))) {
+				if (*file == '\0')
+					continue;
+				failed += chacl_file(file);
+			}
+			if (!feof(list)) {
+				fprintf(stderr, "%s: %s: %s\n",
+					program, files_from, strerror(errno));
+				failed++;
+			}
+			if (list != stdin)
+				fclose(list);
+		}
+	}
 
 	if (acl)
 		acl_free(acl);
@@ -207,6 +250,46 @@ main(int argc, char *argv[])
 	return(failed);
 }
 
+/*
+ *   lists, removes, or places the acls on one file, depending on the mode
+ */
+static int
+chacl_file(const char *file)
+{
+	int failed = 0;
+
+	/* list the acls */
+	if (lflag)
+		return !list_acl(file);
+
+	/* remove the acls */
+	if (Rflag || Dflag || Bflag) {
+		if (!Dflag &&
+		    (acl_delete_file(file, ACL_TYPE_ACCESS) == -1)) {
+			fprintf(stderr, _(
+		"%s: error removing access acl on \"%s\": %s\n"),
+				program, file, strerror(errno));
+			failed++;
+		}
+		if (!Rflag &&
+		    (acl_delete_file(file, ACL_TYPE_DEFAULT) == -1)) {
+			fprintf(stderr, _(
+		"%s: error removing default acl on \"%s\": %s\n"),
+				program, file, strerror(errno));
+			failed++;
+		}
+		return failed;
+	}
+
+	/* place acls on files */
+	if (rflag) {
+		acl_t acls[2] = { acl, dacl };
+
+		return walk_tree(file, walk_flags, 0, walk_set_acl, acls);
+	}
+	return set_acl(acl, dacl, file);
+}
+
 /* 
  *   deletes an access acl or directory default acl if one exists
  */ 
@@ -236,8 +319,9 @@ acl_delete_file(const char *path, acl_type_t type)
 			 }
 			error = acl_get_entry(acl, ACL_NEXT_ENTRY, &entry);
 		}
-		if (!error)
-			error = acl_set_file(path, ACL_TYPE_ACCESS, acl);
+		if (!error && acl_set_file_if_changed(path, ACL_TYPE_ACCESS,
+						      acl) == -1)
+			error = -1;
 	} else
 		error = acl_delete_def_file(path);
 	return(error);
@@ -249,30 +333,24 @@ acl_delete_file(const char *path, acl_type_t type)
  *    return 1 on success
  */
 static int
-list_acl(char *file)
+list_acl(const char *file)
 {
 	acl_t acl = NULL;
 	acl_t dacl = NULL;
 	char *acl_text, *dacl_text = NULL;
 
-	if ((acl = acl_get_file(file, ACL_TYPE_ACCESS)) == NULL) {
+	if (acl_get_file_pair(file, &acl, &dacl, NULL, 0) != 0) {
 		fprintf(stderr, _("%s: cannot get access ACL on '%s': %s\n"),
 			program, file, strerror(errno));
 		return 0;
 	}
-	if ((dacl = acl_get_file(file, ACL_TYPE_DEFAULT)) == NULL &&
-	    (errno != EACCES)) {	/* EACCES given if not a directory */
-		fprintf(stderr, _("%s: cannot get default ACL on '%s': %s\n"),
-			program, file, strerror(errno));
-		return 0;
-	}
 	acl_text = acl_to_any_text(acl, NULL, ',', TEXT_ABBREVIATE);
 	if (acl_text == NULL) {
 		fprintf(stderr, _("%s: cannot get access ACL text on "
 			"'%s': %s\n"), program, file, strerror(errno));
 		return 0;
 	}
-	if (acl_entries(dacl) > 0) {
+	if (dacl) {
 		dacl_text = acl_to_any_text(dacl, NULL, ',', TEXT_ABBREVIATE);
 		if (dacl_text == NULL) {
 			fprintf(stderr, _("%s: cannot get default ACL text on "
@@ -287,7 +365,8 @@ list_acl(char *file)
 		printf("%s [%s]\n", file, acl_text);
 	acl_free(acl_text);
 	acl_free(acl);
-	acl_free(dacl);
+	if (dacl)
+		acl_free(dacl);
 	return 1;
 }
 
@@ -296,17 +375,16 @@ set_acl(acl_t acl, acl_t dacl, const char *fname)
 {
 	int failed = 0;
 
-	if (rflag)
-		failed += walk_dir(acl, dacl, fname);
-
 	/* set regular acl */
-	if (acl && acl_set_file(fname, ACL_TYPE_ACCESS, acl) == -1) {
+	if (acl &&
+	    acl_set_file_if_changed(fname, ACL_TYPE_ACCESS, acl) == -1) {
 		fprintf(stderr, _("%s: cannot set access acl on \"%s\": %s\n"),
 			program, fname, strerror(errno));
 		failed++;
 	}
 	/* set default acl */
-	if (dacl && acl_set_file(fname, ACL_TYPE_DEFAULT, dacl) == -1) {
+	if (dacl &&
+	    acl_set_file_if_changed(fname, ACL_TYPE_DEFAULT, dacl) == -1) {
 		fprintf(stderr, _("%s: cannot set default acl on \"%s\": %s\n"),
 			program, fname, strerror(errno));
 		failed++;
@@ -316,39 +394,17 @@ set_acl(acl_t acl, acl_t dacl, const char *fname)
 }
 
 static int
-walk_dir(acl_t acl, acl_t dacl, const char *fname)
+walk_set_acl(const char *fname, const struct stat *st, int flags, void *arg)
 {
-	int failed = 0;
-	DIR *dir;
-	struct dirent64 *d;
-	char *name;
-
-	if ((dir = opendir(fname)) == NULL) {
-		if (errno != ENOTDIR) {
-			fprintf(stderr, _("%s: opendir failed: %s\n"),
-				program, strerror(errno));
-			return(1);
-		}
-		return(0);	/* got a file, not an error */
-	}
-
-	while ((d = readdir64(dir)) != NULL) {
-		/* skip "." and ".." entries */
-		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
-			continue;
-		
-		name = malloc(strlen(fname) + strlen(d->d_name) + 2);
-		if (name == NULL) {
-			fprintf(stderr, _("%s: malloc failed: %s\n"),
-				program, strerror(errno));
-			exit(1);
-		}
-		sprintf(name, "%s/%s", fname, d->d_name);
+	acl_t *acls = arg;
 
-		failed += set_acl(acl, dacl, name);
-		free(name);
+	if (flags & WALK_TREE_FAILED) {
+		fprintf(stderr, "%s: %s: %s\n", program, fname,
+			strerror(errno));
+		return 1;
 	}
-	closedir(dir);
-
-	return(failed);
+	if (links && !S_ISDIR(st->st_mode) && st->st_nlink > 1 &&
+	    inode_set_add(links, st->st_dev, st->st_ino, NULL) == 1)
+		return 0;
+	return set_acl(acls[0], acls[1], fname);
 }
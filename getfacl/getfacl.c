@@ -31,19 +31,24 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <attr/xattr.h>
 #include <dirent.h>
 #include <libgen.h>
 #include <getopt.h>
 #include <locale.h>
+#include <time.h>
 #include "config.h"
+#include "acl_ea.h"
 #include "user_group.h"
 #include "walk_tree.h"
+#include "inode_set.h"
 #include "misc.h"
+#include "serve.h"
 
 #define POSIXLY_CORRECT_STR "POSIXLY_CORRECT"
 
 #if !POSIXLY_CORRECT
-#  define CMD_LINE_OPTIONS "aceEsRLPtpndvh"
+#  define CMD_LINE_OPTIONS "aceEsRLPtpndvh0"
 #endif
 #define POSIXLY_CMD_LINE_OPTIONS "d"
 
@@ -60,6 +65,16 @@ struct option long_options[] = {
 	{ "tabular",	0, 0, 't' },
 	{ "absolute-names",	0, 0, 'p' },
 	{ "numeric",	0, 0, 'n' },
+	{ "io-uring",	0, 0, 'U' },
+	{ "order",	1, 0, 'O' },
+	{ "batch",	1, 0, 'B' },
+	{ "changed-since",	1, 0, 'C' },
+	{ "state-file",	1, 0, 'S' },
+	{ "hard-links",	0, 0, 'H' },
+	{ "files-from",	1, 0, 'F' },
+	{ "null",	0, 0, '0' },
+	{ "serve",	2, 0, 'V' },
+	WALK_TREE_LONG_OPTIONS,
 #endif
 	{ "default",	0, 0, 'd' },
 	{ "version",	0, 0, 'v' },
@@ -86,6 +101,16 @@ int had_errors;
 int absolute_warning;  /* Absolute path warning was issued */
 int print_options = TEXT_SOME_EFFECTIVE;
 int opt_numeric;  /* don't convert id's to symbolic names */
+int opt_incremental;  /* only list objects changed since opt_changed_since */
+const char *opt_files_from;  /* file listing further files to list */
+int opt_null;  /* names of files are separated by null characters */
+int opt_serve;  /* serve requests instead of listing files */
+const char *opt_serve_socket;  /* socket to serve requests from, or NULL */
+struct timespec opt_changed_since;
+const char *opt_state_file;  /* remembers when the last scan started */
+struct inode_set *hard_links;  /* hard linked files already listed */
+void *acl_buf;  /* buffer for reading ACLs, reused for all files */
+size_t acl_buf_size;
 
 
 static const char *xquote(const char *str, const char *quote_chars)
@@ -409,20 +434,6 @@ int do_show(FILE *stream, const char *path_p, const struct stat *st,
 	return 0;
 }
 
-/*
- * Create an ACL from the file permission bits
- * of the file PATH_P.
- */
-static acl_t
-acl_get_file_mode(const char *path_p)
-{
-	struct stat st;
-
-	if (stat(path_p, &st) != 0)
-		return NULL;
-	return acl_from_mode(st.st_mode);
-}
-
 static const char *
 flagstr(mode_t mode)
 {
@@ -435,11 +446,155 @@ flagstr(mode_t mode)
 	return str;
 }
 
+/*
+ * Parse a timestamp of the form [@]SECONDS[.FRACTION], in seconds since
+ * the Epoch.
+ */
+static int
+parse_timestamp(const char *str, struct timespec *ts)
+{
+	const char *p;
+	char *end;
+	long nsec = 0, scale = 100000000;
+
+	if (*str == '@')
+		str++;
+	if (*str < '0' || *str > '9')
+		return -1;
+	errno = 0;
+	ts->tv_sec = strtoll(str, &end, 10);
+	if (errno)
+		return -1;
+	if (*end == '.') {
+		for (p = end + 1; *p >= '0' && *p <= '9'; p++) {
+			nsec += (*p - '0') * scale;
+			scale /= 10;
+		}
+		end = (char *)p;
+	}
+	ts->tv_nsec = nsec;
+	while (*end == '\n')
+		end++;
+	return *end ? -1 : 0;
+}
+
+/*
+ * Read the start time of the previous scan from the state file. A missing
+ * state file means that everything is listed.
+ */
+static int
+read_state_file(const char *path, struct timespec *ts)
+{
+	char buffer[64];
+	FILE *file;
+	int error = 0;
+
+	file = fopen(path, "r");
+	if (!file)
+		return errno == ENOENT ? 0 : -1;
+	if (!fgets(buffer, sizeof(buffer), file) ||
+	    parse_timestamp(buffer, ts) != 0) {
+		errno = EINVAL;
+		error = -1;
+	} else
+		opt_incremental = 1;
+	fclose(file);
+	return error;
+}
+
+static int
+write_state_file(const char *path, const struct timespec *ts)
+{
+	char *tmp;
+	FILE *file;
+	int error;
+
+	tmp = malloc(strlen(path) + 5);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", path);
+	file = fopen(tmp, "w");
+	if (!file) {
+		free(tmp);
+		return -1;
+	}
+	fprintf(file, "%lld.%09ld\n", (long long)ts->tv_sec, ts->tv_nsec);
+	error = ferror(file);
+	if (fclose(file) != 0 || error || rename(tmp, path) != 0) {
+		error = errno;
+		unlink(tmp);
+		free(tmp);
+		errno = error;
+		return -1;
+	}
+	free(tmp);
+	return 0;
+}
+
+static const char *
+strip_path(const char *path_p)
+{
+	if (*path_p == '/') {
+		if (!absolute_warning) {
+			fprintf(stderr, _("%s: Removing leading "
+				"'/' from absolute path names\n"),
+			        progname);
+			absolute_warning = 1;
+		}
+		while (*path_p == '/')
+			path_p++;
+	} else if (*path_p == '.' && *(path_p+1) == '/')
+		while (*++path_p == '/')
+			/* nothing */ ;
+	if (*path_p == '\0')
+		path_p = ".";
+	return path_p;
+}
+
+/*
+ * Find out which ACL attributes a file has with a single listxattr()
+ * call: returns a combination of HAS_ACCESS_ACL and HAS_DEFAULT_ACL, or
+ * -1 if the attributes cannot be listed.
+ */
+#define HAS_ACCESS_ACL	1
+#define HAS_DEFAULT_ACL	2
+
+static int
+acl_names(const char *path_p)
+{
+	static char *names;
+	static size_t names_size;
+	const char *name, *end;
+	ssize_t size;
+	int has = 0;
+
+	if (high_water_alloc((void **)&names, &names_size, 256))
+		return -1;
+	size = listxattr(path_p, names, names_size);
+	if (size < 0 && errno == ERANGE) {
+		size = listxattr(path_p, NULL, 0);
+		if (size < 0 ||
+		    high_water_alloc((void **)&names, &names_size, size))
+			return -1;
+		size = listxattr(path_p, names, names_size);
+	}
+	if (size < 0)
+		return -1;
+	for (name = names, end = names + size; name < end;
+	     name += strlen(name) + 1) {
+		if (!strcmp(name, ACL_EA_ACCESS))
+			has |= HAS_ACCESS_ACL;
+		else if (!strcmp(name, ACL_EA_DEFAULT))
+			has |= HAS_DEFAULT_ACL;
+	}
+	return has;
+}
+
 int do_print(const char *path_p, const struct stat *st, int walk_flags, void *unused)
 {
 	const char *default_prefix = NULL;
 	acl_t acl = NULL, default_acl = NULL;
-	int error = 0;
+	int error = 0, track_link = 0, has = -1;
 
 	if (walk_flags & WALK_TREE_FAILED) {
 		fprintf(stderr, "%s: %s: %s\n", progname, xquote(path_p, "\n\r"),
@@ -457,17 +612,90 @@ int do_print(const char *path_p, const struct stat *st, int walk_flags, void *un
 	     !(walk_flags & (WALK_TREE_TOPLEVEL | WALK_TREE_LOGICAL))))
 		return 0;
 
+	/*
+	 * Changing an ACL always updates the ctime, so objects whose ctime
+	 * is older than the threshold cannot have changed ACLs.
+	 */
+	if (opt_incremental &&
+	    (st->st_ctim.tv_sec < opt_changed_since.tv_sec ||
+	     (st->st_ctim.tv_sec == opt_changed_since.tv_sec &&
+	      st->st_ctim.tv_nsec < opt_changed_since.tv_nsec)))
+		return 0;
+
+	/*
+	 * Further links to a file already listed are only listed as a
+	 * reference to the first link.
+	 */
+	if (hard_links && !S_ISDIR(st->st_mode) && st->st_nlink > 1) {
+		const char *first_path;
+
+		if (inode_set_find(hard_links, st->st_dev, st->st_ino,
+				   &first_path)) {
+			if (!first_path)
+				return 0;
+			if (opt_strip_leading_slash)
+				path_p = strip_path(path_p);
+			printf("# file: %s\n", xquote(path_p, "\n\r"));
+			printf("# same as: %s\n\n",
+			       xquote(first_path, "\n\r"));
+			return 0;
+		}
+		track_link = 1;
+	}
+
+	if (opt_skip_base) {
+		const void *value;
+		ssize_t size;
+
+		/*
+		 * Most objects are skipped: when the ACLs have not been
+		 * prefetched, check which exist before reading any.
+		 */
+		if (!walk_tree_xattr(ACL_EA_ACCESS, &value, &size))
+			has = acl_names(path_p);
+		if (has == 0) {
+			if (track_link)
+				inode_set_add(hard_links, st->st_dev,
+					      st->st_ino, NULL);
+			return 0;
+		}
+	}
+
 	if (opt_print_acl) {
-		acl = acl_get_file(path_p, ACL_TYPE_ACCESS);
+		const void *value;
+		ssize_t size = 0;
+
+		/* Objects without an ACL are the common case. */
+		if ((walk_tree_xattr(ACL_EA_ACCESS, &value, &size) &&
+		     size < 0) ||
+		    (has != -1 && !(has & HAS_ACCESS_ACL)))
+			acl = acl_from_mode(st->st_mode);
+		else if (size > 0)
+			acl = acl_from_xattr(value, size);
+		else
+			acl = acl_get_file_buf(path_p, ACL_TYPE_ACCESS, st,
+					       &acl_buf, &acl_buf_size);
 		if (acl == NULL && (errno == ENOSYS || errno == ENOTSUP))
-			acl = acl_get_file_mode(path_p);
+			acl = acl_from_mode(st->st_mode);
 		if (acl == NULL)
 			goto fail;
 	}
 
 	if (opt_print_default_acl && S_ISDIR(st->st_mode)) {
-		default_acl = acl_get_file(path_p, ACL_TYPE_DEFAULT);
-		if (default_acl == NULL) {
+		const void *value;
+		ssize_t size = 0;
+
+		if ((walk_tree_xattr(ACL_EA_DEFAULT, &value, &size) &&
+		     size < 0) ||
+		    (has != -1 && !(has & HAS_DEFAULT_ACL)))
+			default_acl = NULL;
+		else if (size > 0) {
+			default_acl = acl_from_xattr(value, size);
+			if (default_acl == NULL)
+				goto fail;
+		} else if ((default_acl = acl_get_file_buf(path_p,
+					ACL_TYPE_DEFAULT, st, &acl_buf,
+					&acl_buf_size)) == NULL) {
 			if (errno != ENOSYS && errno != ENOTSUP)
 				goto fail;
 		} else if (acl_entries(default_acl) == 0) {
@@ -477,28 +705,20 @@ int do_print(const char *path_p, const struct stat *st, int walk_flags, void *un
 	}
 
 	if (opt_skip_base &&
-	    (!acl || acl_equiv_mode(acl, NULL) == 0) && !default_acl)
+	    (!acl || acl_equiv_mode(acl, NULL) == 0) && !default_acl) {
+		if (track_link)
+			inode_set_add(hard_links, st->st_dev, st->st_ino,
+				      NULL);
 		return 0;
+	}
 
 	if (opt_print_acl && opt_print_default_acl)
 		default_prefix = "default:";
 
-	if (opt_strip_leading_slash) {
-		if (*path_p == '/') {
-			if (!absolute_warning) {
-				fprintf(stderr, _("%s: Removing leading "
-					"'/' from absolute path names\n"),
-				        progname);
-				absolute_warning = 1;
-			}
-			while (*path_p == '/')
-				path_p++;
-		} else if (*path_p == '.' && *(path_p+1) == '/')
-			while (*++path_p == '/')
-				/* nothing */ ;
-		if (*path_p == '\0')
-			path_p = ".";
-	}
+	if (opt_strip_leading_slash)
+		path_p = strip_path(path_p);
+	if (track_link)
+		inode_set_add(hard_links, st->st_dev, st->st_ino, path_p);
 
 	if (opt_tabular)  {
 		if (do_show(stdout, path_p, st, acl, default_acl) != 0)
@@ -580,7 +800,26 @@ void help(void)
 "  -P, --physical          physical walk, do not follow symbolic links\n"
 "  -t, --tabular           use tabular output format\n"
 "  -n, --numeric           print numeric user/group identifiers\n"
-"  -p, --absolute-names    don't strip leading '/' in pathnames\n"));
+"  -p, --absolute-names    don't strip leading '/' in pathnames\n"
+"      --io-uring          batch metadata reads with io_uring when walking\n"
+"      --order=ORDER       visit directory entries in readdir, inode, or\n"
+"                          name order\n"
+"      --batch=N           read and sort N directory entries at a time\n"
+"      --one-file-system   do not cross file system boundaries\n"
+"      --exclude=PATTERN   skip files matching PATTERN\n"
+"      --exclude-from=FILE skip files matching any pattern in FILE\n"
+"      --type=d|f          only list directories or regular files\n"
+"      --max-depth=N       descend at most N levels below the arguments\n"
+"      --changed-since=TIMESTAMP\n"
+"                          only list files changed since TIMESTAMP\n"
+"      --state-file=FILE   only list files changed since the scan that\n"
+"                          last updated FILE, and update FILE\n"
+"      --hard-links        list further links to a file as a reference\n"
+"                          to the first link\n"
+"      --files-from=FILE   also list the files named in FILE\n"
+"  -0, --null              file names in FILE are separated by null\n"
+"                          characters instead of newlines\n"
+"      --serve[=SOCKET]    serve requests from standard input or SOCKET\n"));
 	}
 #endif
 	printf(_(
@@ -588,10 +827,65 @@ void help(void)
 "  -h, --help              this help text\n"));
 }
 
+/*
+ * List the files named in LIST, which is called LIST_NAME in error
+ * messages, or is standard input.
+ */
+static int print_names(FILE *list, const char *list_name)
+{
+	char *name;
+	int errors = 0;
+
+	while ((name = next_name(list, opt_null)) != NULL) {
+		if (*name == '\0')
+			continue;
+
+		errors += walk_tree(name, walk_flags, 0, do_print, NULL);
+	}
+	if (!feof(list)) {
+		if (list_name)
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				xquote(list_name, "\n\r"), strerror(errno));
+		else
+			fprintf(stderr, _("%s: Standard input: %s\n"),
+				progname, strerror(errno));
+		errors++;
+	}
+	return errors;
+}
+
+/*
+ * Serve one --serve request, which lists the files it names. Hard links
+ * are only recognized within a request.
+ */
+static int serve_getfacl(int argc, char *argv[], void *unused)
+{
+	int n, errors = 0;
+
+	if (argc == 0) {
+		fprintf(stderr, _("%s: Request without files\n"), progname);
+		return 2;
+	}
+	absolute_warning = 0;
+	if (hard_links) {
+		inode_set_free(hard_links);
+		hard_links = inode_set_create(0);
+		if (!hard_links) {
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			return 1;
+		}
+	}
+	for (n = 0; n < argc; n++)
+		errors += walk_tree(argv[n], walk_flags, 0, do_print, NULL);
+	return errors ? 1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int opt;
-	char *line;
+	char *end;
+	unsigned long batch;
+	struct timespec scan_start;
 
 	progname = basename(argv[0]);
 
@@ -686,6 +980,104 @@ int main(int argc, char *argv[])
 				opt_tabular = 1;
 				break;
 
+			case 'U':  /* batch metadata reads with io_uring */
+				if (posixly_correct)
+					goto synopsis;
+				if (walk_flags & WALK_TREE_URING)
+					break;
+				walk_flags |= WALK_TREE_URING;
+				walk_tree_prefetch_xattr(ACL_EA_ACCESS, 0);
+				walk_tree_prefetch_xattr(ACL_EA_DEFAULT, 1);
+				break;
+
+			case 'O':  /* order of directory entries */
+				if (posixly_correct)
+					goto synopsis;
+				walk_flags &= ~(WALK_TREE_INODE_ORDER |
+						WALK_TREE_NAME_ORDER);
+				if (strcmp(optarg, "inode") == 0)
+					walk_flags |= WALK_TREE_INODE_ORDER;
+				else if (strcmp(optarg, "name") == 0)
+					walk_flags |= WALK_TREE_NAME_ORDER;
+				else if (strcmp(optarg, "readdir") != 0)
+					goto synopsis;
+				break;
+
+			case 'B':  /* directory entries per batch */
+				if (posixly_correct)
+					goto synopsis;
+				batch = strtoul(optarg, &end, 10);
+				if (*end || batch > UINT_MAX ||
+				    walk_tree_set_batch(batch) != 0)
+					goto synopsis;
+				break;
+
+			case WALK_TREE_OPT_ONE_FILESYSTEM:
+			case WALK_TREE_OPT_EXCLUDE:
+			case WALK_TREE_OPT_EXCLUDE_FROM:
+			case WALK_TREE_OPT_TYPE:
+			case WALK_TREE_OPT_MAX_DEPTH:
+				if (posixly_correct)
+					goto synopsis;
+				if (walk_tree_option(opt, optarg,
+						     &walk_flags) != 0) {
+					fprintf(stderr, "%s: %s: %s\n",
+						progname, xquote(optarg, "\n\r"),
+						strerror(errno));
+					return 2;
+				}
+				break;
+
+			case 'C':  /* only list recently changed objects */
+				if (posixly_correct)
+					goto synopsis;
+				if (parse_timestamp(optarg,
+						    &opt_changed_since) != 0) {
+					fprintf(stderr, _("%s: Invalid "
+						"timestamp `%s'\n"), progname,
+						xquote(optarg, "\n\r"));
+					return 2;
+				}
+				opt_incremental = 1;
+				break;
+
+			case 'H':  /* list hard links only once */
+				if (posixly_correct)
+					goto synopsis;
+				if (!hard_links)
+					hard_links = inode_set_create(0);
+				if (!hard_links) {
+					fprintf(stderr, "%s: %s\n", progname,
+						strerror(errno));
+					return 1;
+				}
+				break;
+
+			case 'S':  /* state file for incremental scans */
+				if (posixly_correct)
+					goto synopsis;
+				opt_state_file = optarg;
+				break;
+
+			case 'F':  /* list of file arguments */
+				if (posixly_correct)
+					goto synopsis;
+				opt_files_from = optarg;
+				break;
+
+			case '0':  /* null separated file names */
+				if (posixly_correct)
+					goto synopsis;
+				opt_null = 1;
+				break;
+
+			case 'V':  /* serve requests */
+				if (posixly_correct)
+					goto synopsis;
+				opt_serve = 1;
+				opt_serve_socket = optarg;
+				break;
+
 			case 'n':  /* numeric */
 				opt_numeric = 1;
 				print_options |= TEXT_NUMERIC_IDS;
@@ -712,29 +1104,77 @@ int main(int argc, char *argv[])
 			opt_print_default_acl = 1;
 	}
 		
-	if ((optind == argc) && !posixly_correct)
+	if (opt_serve) {
+		if (optind != argc || opt_files_from || opt_state_file)
+			goto synopsis;
+		if (serve(opt_serve_socket, serve_getfacl, NULL) != 0) {
+			if (opt_serve_socket)
+				fprintf(stderr, "%s: %s: %s\n", progname,
+					xquote(opt_serve_socket, "\n\r"),
+					strerror(errno));
+			else
+				fprintf(stderr, _("%s: Standard input: %s\n"),
+					progname, strerror(errno));
+			return 1;
+		}
+		return 0;
+	}
+
+	if ((optind == argc) && !opt_files_from && !posixly_correct)
 		goto synopsis;
 
-	do {
-		if (optind == argc ||
-		    strcmp(argv[optind], "-") == 0) {
-			while ((line = next_line(stdin)) != NULL) {
-				if (*line == '\0')
-					continue;
+	if (opt_state_file) {
+		/*
+		 * An explicit --changed-since takes precedence over the
+		 * state file. File system timestamps may lag behind the
+		 * clock a little, so start the next scan a second early.
+		 */
+		if (!opt_incremental &&
+		    read_state_file(opt_state_file, &opt_changed_since) != 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				xquote(opt_state_file, "\n\r"),
+				strerror(errno));
+			return 1;
+		}
+		clock_gettime(CLOCK_REALTIME, &scan_start);
+		scan_start.tv_sec--;
+	}
 
-				had_errors += walk_tree(line, walk_flags, 0,
-							do_print, NULL);
-			}
-			if (!feof(stdin)) {
-				fprintf(stderr, _("%s: Standard input: %s\n"),
-				        progname, strerror(errno));
-				had_errors++;
-			}
-		} else
+	if (optind == argc && !opt_files_from)
+		had_errors += print_names(stdin, NULL);
+	for (; optind < argc; optind++) {
+		if (strcmp(argv[optind], "-") == 0)
+			had_errors += print_names(stdin, NULL);
+		else
 			had_errors += walk_tree(argv[optind], walk_flags, 0,
 						do_print, NULL);
-		optind++;
-	} while (optind < argc);
+	}
+	if (opt_files_from) {
+		if (strcmp(opt_files_from, "-") == 0)
+			had_errors += print_names(stdin, NULL);
+		else {
+			FILE *file = fopen(opt_files_from, "r");
+
+			if (file) {
+				had_errors += print_names(file,
+							  opt_files_from);
+				fclose(file);
+			} else {
+				fprintf(stderr, "%s: %s: %s\n", progname,
+					xquote(opt_files_from, "\n\r"),
+					strerror(errno));
+				had_errors++;
+			}
+		}
+	}
+
+	/* Only advance the state after a complete scan. */
+	if (opt_state_file && !had_errors &&
+	    write_state_file(opt_state_file, &scan_start) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname,
+			xquote(opt_state_file, "\n\r"), strerror(errno));
+		had_errors++;
+	}
 
 	return had_errors ? 1 : 0;
 
@@ -0,0 +1,42 @@
+/*
+  File: inode_set.h
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License as published by the
+  Free Software Foundation; either version 2.1 of the License, or (at
+  your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __INODE_SET_H
+#define __INODE_SET_H
+
+#include <sys/types.h>
+
+/*
+ * A set of (device, inode) pairs for recognizing hard links that have
+ * been seen before. The set holds at most a fixed number of inodes; once
+ * it is full, further inodes are not remembered, so they are processed
+ * again when seen again.
+ */
+
+struct inode_set;
+
+/* Default limit on the number of inodes remembered */
+#define INODE_SET_MAX	(1 << 20)
+
+extern struct inode_set *inode_set_create(size_t max_entries);
+extern void inode_set_free(struct inode_set *set);
+extern int inode_set_add(struct inode_set *set, dev_t dev, ino_t ino,
+			 const char *path);
+extern int inode_set_find(struct inode_set *set, dev_t dev, ino_t ino,
+			  const char **path);
+
+#endif
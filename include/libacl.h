@@ -58,6 +58,7 @@ extern int acl_cmp(acl_t acl1, acl_t acl2);
 extern int acl_check(acl_t acl, int *last);
 extern acl_t acl_from_mode(mode_t mode);
 extern int acl_equiv_mode(acl_t acl, mode_t *mode_p);
+extern int acl_minimize(acl_t acl);
 int acl_extended_file(const char *path_p);
 int acl_extended_file_nofollow(const char *path_p);
 int acl_extended_fd(int fd);
@@ -65,6 +66,67 @@ extern int acl_entries(acl_t acl);
 extern const char *acl_error(int code);
 extern int acl_get_perm(acl_permset_t permset_d, acl_perm_t perm);
 
+/* Getting ACLs with the file status already known */
+struct stat;
+extern acl_t acl_get_file_st(const char *path_p, acl_type_t type,
+			     const struct stat *st_p);
+extern acl_t acl_get_fd_st(int fd, const struct stat *st_p);
+
+/* Getting ACLs into a reusable buffer */
+extern acl_t acl_get_file_buf(const char *path_p, acl_type_t type,
+			      const struct stat *st_p, void **buf_p,
+			      size_t *size_p);
+extern acl_t acl_get_fd_buf(int fd, const struct stat *st_p, void **buf_p,
+			    size_t *size_p);
+extern int acl_get_file_pair(const char *path_p, acl_t *access_p,
+			     acl_t *default_p, struct stat *st_p, int flags);
+
+/* Setting ACLs only if they differ from the current ones */
+extern int acl_set_file_if_changed(const char *path_p, acl_type_t type,
+				   acl_t acl);
+extern int acl_set_fd_if_changed(int fd, acl_t acl);
+
+/* Getting and setting the ACLs of many files at once */
+struct acl_batch {
+	int dirfd;		/* as for acl_get_fileat() */
+	const char *path_p;
+	acl_type_t type;
+	int flags;
+	acl_t acl;		/* result of acl_get_files(), or ACL to set */
+	int error;		/* errno value, or 0 on success */
+};
+
+#define ACL_BATCH_SYNC		0  /* one file after the other */
+#define ACL_BATCH_THREADS	1  /* with a pool of threads */
+#define ACL_BATCH_URING		2  /* with io_uring if available */
+
+extern int acl_get_files(struct acl_batch *batch, size_t count, int engine);
+extern int acl_set_files(struct acl_batch *batch, size_t count, int engine);
+
+/* Converting from and to the extended attribute representation */
+extern acl_t acl_from_xattr(const void *buf_p, size_t size);
+extern ssize_t acl_to_xattr(acl_t acl, void *buf_p, size_t size);
+extern int acl_xattr_valid(const void *buf_p, size_t size);
+
+/* Caching the ACLs of files that are looked up repeatedly */
+struct acl_cache;
+extern struct acl_cache *acl_cache_create(size_t size);
+extern void acl_cache_destroy(struct acl_cache *cache);
+extern acl_t acl_cache_get(struct acl_cache *cache, const char *path_p,
+			   acl_type_t type, const struct stat *st_p);
+extern acl_t acl_cache_get_fd(struct acl_cache *cache, int fd,
+			      const struct stat *st_p);
+extern void acl_cache_stats(struct acl_cache *cache, unsigned long *hits_p,
+			    unsigned long *misses_p);
+
+/* Accessing ACLs relative to a directory file descriptor */
+extern acl_t acl_get_fileat(int dirfd, const char *path_p, acl_type_t type,
+			    int flags);
+extern int acl_set_fileat(int dirfd, const char *path_p, acl_type_t type,
+			  acl_t acl, int flags);
+extern int acl_delete_def_fileat(int dirfd, const char *path_p, int flags);
+extern int acl_extended_fileat(int dirfd, const char *path_p, int flags);
+
 /* Copying permissions between files */
 struct error_context;
 extern int perm_copy_file (const char *, const char *,
@@ -72,6 +134,13 @@ extern int perm_copy_file (const char *, const char *,
 extern int perm_copy_fd (const char *, int, const char *, int,
 			  struct error_context *);
 
+/* Flags for perm_copy_tree() */
+#define PERM_COPY_TREE_LOGICAL		0x01
+#define PERM_COPY_TREE_ONE_FILESYSTEM	0x02
+
+extern int perm_copy_tree (const char *, const char *, int, int,
+			   struct error_context *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,3 +21,4 @@ extern const char *quote(const char *str, const char *quote_chars);
 extern char *unquote(char *str);
 
 extern char *next_line(FILE *file);
+extern char *next_name(FILE *file, int null_separated);
@@ -0,0 +1,47 @@
+/*
+  File: serve.h
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License as published by the
+  Free Software Foundation; either version 2.1 of the License, or (at
+  your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SERVE_H
+#define __SERVE_H
+
+/*
+ * Serve requests from standard input, or from the connections to a Unix
+ * domain socket. A request is a line of fields separated by whitespace;
+ * whitespace and backslashes within fields are escaped as \ooo octal
+ * sequences, like the file names in getfacl output. For each request,
+ * the handler is called with the unescaped fields. What it writes to
+ * stdout and stderr is sent back as the response
+ *
+ *	<status> <output size> <error size>\n<output><errors>
+ *
+ * where status is the value the handler returned. The output is captured
+ * by redirecting stdout and stderr, which are shared by all threads, so
+ * requests are served one at a time, from all connections: a slow request
+ * holds up the requests of all other connections until it completes.
+ * Handlers need not be thread safe.
+ *
+ * The socket is only accessible to its owner, and connections from other
+ * users than the owner and root are refused. Responses are sent without
+ * blocking, so a client that does not read them only holds up its own
+ * requests. Connections sending requests longer than 1 MiB are closed.
+ */
+
+typedef int (*serve_handler_t)(int argc, char *argv[], void *arg);
+
+extern int serve(const char *socket_path, serve_handler_t handler, void *arg);
+
+#endif  /* __SERVE_H */
@@ -0,0 +1,59 @@
+/*
+  File: uring.h
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License as published by the
+  Free Software Foundation; either version 2.1 of the License, or (at
+  your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __URING_H
+#define __URING_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * A minimal io_uring submission/completion ring for the metadata
+ * operations we need (statx and xattr access). uring_init() fails with
+ * ENOSYS when the kernel or the build does not support io_uring, and
+ * callers are expected to fall back to plain system calls.
+ */
+
+struct uring;
+
+/* Operations that may or may not be supported by the running kernel */
+#define URING_STATX		0x01
+#define URING_GETXATTR		0x02
+#define URING_SETXATTR		0x04
+
+extern struct uring *uring_init(unsigned int entries);
+extern void uring_exit(struct uring *ring);
+extern int uring_supports(struct uring *ring, int ops);
+extern unsigned int uring_space(struct uring *ring);
+extern unsigned int uring_unsubmitted(struct uring *ring);
+
+extern int uring_statx(struct uring *ring, int dirfd, const char *path,
+		       int flags, unsigned int mask, void *statxbuf,
+		       uint64_t user_data);
+extern int uring_getxattr(struct uring *ring, const char *path,
+			  const char *name, void *value, size_t size,
+			  uint64_t user_data);
+extern int uring_fgetxattr(struct uring *ring, int fd, const char *name,
+			   void *value, size_t size, uint64_t user_data);
+extern int uring_setxattr(struct uring *ring, const char *path,
+			  const char *name, const void *value, size_t size,
+			  int flags, uint64_t user_data);
+
+extern int uring_submit(struct uring *ring);
+extern int uring_wait(struct uring *ring, uint64_t *user_data, int *res);
+
+#endif
@@ -20,20 +20,52 @@
 #ifndef __WALK_TREE_H
 #define __WALK_TREE_H
 
+#include <sys/types.h>
+
 #define WALK_TREE_RECURSIVE		0x01
 #define WALK_TREE_PHYSICAL		0x02
 #define WALK_TREE_LOGICAL		0x04
 #define WALK_TREE_DEREFERENCE		0x08
 #define WALK_TREE_DEREFERENCE_TOPLEVEL	0x10
+#define WALK_TREE_URING			0x20
+#define WALK_TREE_INODE_ORDER		0x40
+#define WALK_TREE_NAME_ORDER		0x80
+#define WALK_TREE_ONE_FILESYSTEM	0x1000
+#define WALK_TREE_ONLY_DIRS		0x2000
+#define WALK_TREE_ONLY_FILES		0x4000
+#define WALK_TREE_POSTORDER		0x8000
 
 #define WALK_TREE_TOPLEVEL	0x100
 #define WALK_TREE_SYMLINK	0x200
 #define WALK_TREE_FAILED	0x400
 
+/* Long options for pruning the walk, see walk_tree_option() */
+#define WALK_TREE_OPT_ONE_FILESYSTEM	0x100
+#define WALK_TREE_OPT_EXCLUDE		0x101
+#define WALK_TREE_OPT_EXCLUDE_FROM	0x102
+#define WALK_TREE_OPT_TYPE		0x103
+#define WALK_TREE_OPT_MAX_DEPTH		0x104
+
+#define WALK_TREE_LONG_OPTIONS \
+	{ "one-file-system",	0, 0, WALK_TREE_OPT_ONE_FILESYSTEM }, \
+	{ "exclude",		1, 0, WALK_TREE_OPT_EXCLUDE }, \
+	{ "exclude-from",	1, 0, WALK_TREE_OPT_EXCLUDE_FROM }, \
+	{ "type",		1, 0, WALK_TREE_OPT_TYPE }, \
+	{ "max-depth",		1, 0, WALK_TREE_OPT_MAX_DEPTH }
+
 struct stat;
 
 extern int walk_tree(const char *path, int walk_flags, unsigned int num,
 		     int (*func)(const char *, const struct stat *, int,
 				 void *), void *arg);
 
+extern int walk_tree_set_batch(unsigned int batch);
+extern void walk_tree_set_max_depth(int depth);
+extern int walk_tree_exclude(const char *pattern);
+extern int walk_tree_exclude_from(const char *file);
+extern int walk_tree_option(int opt, const char *arg, int *walk_flags);
+extern int walk_tree_prefetch_xattr(const char *name, int dirs_only);
+extern int walk_tree_xattr(const char *name, const void **value,
+			   ssize_t *size);
+
 #endif
@@ -0,0 +1,145 @@
+/*
+  File: __acl_copy_xattr.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <attr/xattr.h>
+#include "libacl.h"
+#include "__acl_copy_xattr.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+/* Bigger ACLs are copied the slow way. */
+#define COPY_SIZE	(sizeof(acl_ea_header) + 256 * sizeof(acl_ea_entry))
+
+
+static ssize_t
+get_xattr(const char *path, int fd, const char *name, void *value,
+	  size_t size)
+{
+	if (fd != -1)
+		return fgetxattr(fd, name, value, size);
+	return getxattr(path, name, value, size);
+}
+
+static int
+set_xattr(const char *path, int fd, const char *name, const void *value,
+	  size_t size)
+{
+	if (fd != -1)
+		return fsetxattr(fd, name, value, size, 0);
+	return setxattr(path, name, value, size, 0);
+}
+
+static int
+remove_xattr(const char *path, int fd, const char *name)
+{
+	if (fd != -1)
+		return fremovexattr(fd, name);
+	return removexattr(path, name);
+}
+
+/* The access ACL equivalent to the permission bits in mode. */
+static size_t
+mode_to_xattr(mode_t mode, void *value)
+{
+	acl_ea_header *ext_header_p = value;
+	acl_ea_entry *ext_entry_p = ext_header_p->a_entries;
+
+	ext_header_p->a_version = cpu_to_le32(ACL_EA_VERSION);
+	ext_entry_p[0].e_tag = cpu_to_le16(ACL_USER_OBJ);
+	ext_entry_p[0].e_perm = cpu_to_le16((mode & S_IRWXU) >> 6);
+	ext_entry_p[1].e_tag = cpu_to_le16(ACL_GROUP_OBJ);
+	ext_entry_p[1].e_perm = cpu_to_le16((mode & S_IRWXG) >> 3);
+	ext_entry_p[2].e_tag = cpu_to_le16(ACL_OTHER);
+	ext_entry_p[2].e_perm = cpu_to_le16(mode & S_IRWXO);
+	ext_entry_p[0].e_id = ext_entry_p[1].e_id = ext_entry_p[2].e_id =
+		cpu_to_le32(ACL_UNDEFINED_ID);
+	return acl_ea_size(3);
+}
+
+/*
+ * Copy an ACL attribute from one file to another without decoding it,
+ * and leave the destination alone if it already has the same value.
+ * Files are accessed through their file descriptors unless those are
+ * -1. A missing access ACL is copied as the ACL equivalent to mode.
+ * Returns 0 on success. Returns -1 if the ACL must be copied the slow
+ * way instead: when ACLs are not supported, the ACL is very big, or
+ * anything else goes wrong, which the slow way will then report.
+ */
+int
+__acl_copy_xattr(const char *src_path, int src_fd, const char *dst_path,
+		 int dst_fd, acl_type_t type, mode_t mode)
+{
+	char value[COPY_SIZE], old_value[COPY_SIZE];
+	const acl_ea_header *ext_header_p = (acl_ea_header *)value;
+	const char *name;
+	ssize_t size, old_size;
+	int from_mode = 0;
+
+	switch (type) {
+		case ACL_TYPE_ACCESS:
+			name = ACL_EA_ACCESS;
+			break;
+		case ACL_TYPE_DEFAULT:
+			name = ACL_EA_DEFAULT;
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+
+	size = get_xattr(src_path, src_fd, name, value, sizeof(value));
+	if (size < 0) {
+		if (errno != ENOATTR && errno != ENODATA)
+			return -1;
+		if (type == ACL_TYPE_DEFAULT) {
+			if (remove_xattr(dst_path, dst_fd, name) != 0 &&
+			    errno != ENOATTR && errno != ENODATA)
+				return -1;
+			return 0;
+		}
+		size = mode_to_xattr(mode, value);
+		from_mode = 1;
+	} else if (acl_ea_count(size) < 0 ||
+		   ext_header_p->a_version != cpu_to_le32(ACL_EA_VERSION)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	old_size = get_xattr(dst_path, dst_fd, name, old_value,
+			     sizeof(old_value));
+	if (old_size == size && memcmp(old_value, value, size) == 0)
+		return 0;
+	if (old_size < 0 && (errno == ENOATTR || errno == ENODATA)) {
+		struct stat st;
+
+		if (from_mode) {
+			if ((dst_fd != -1 ? fstat(dst_fd, &st) :
+					    stat(dst_path, &st)) != 0)
+				return -1;
+			if ((st.st_mode & 0777) == (mode & 0777))
+				return 0;
+		}
+	} else if (old_size < 0 && errno != ERANGE)
+		return -1;
+
+	return set_xattr(dst_path, dst_fd, name, value, size);
+}
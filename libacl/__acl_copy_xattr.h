@@ -0,0 +1,2 @@
+int __acl_copy_xattr(const char *src_path, int src_fd, const char *dst_path,
+		     int dst_fd, acl_type_t type, mode_t mode);
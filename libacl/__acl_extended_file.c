@@ -20,6 +20,7 @@
 */
 
 #include <unistd.h>
+#include <string.h>
 #include <attr/xattr.h>
 #include "libacl.h"
 
@@ -28,23 +29,59 @@
 #include "__acl_extended_file.h"
 
 
+/*
+ * Check which ACL attributes are in the list of attribute names
+ * returned by listxattr().
+ */
+int
+__acl_names(const char *names, ssize_t size)
+{
+	const char *end = names + size;
+	int has = 0;
+
+	while (names < end) {
+		if (!strcmp(names, ACL_EA_ACCESS))
+			has |= __ACL_HAS_ACCESS;
+		else if (!strcmp(names, ACL_EA_DEFAULT))
+			has |= __ACL_HAS_DEFAULT;
+		names += strlen(names) + 1;
+	}
+	return has;
+}
+
 int
 __acl_extended_file(const char *path_p,
 		    ssize_t (*fun)(const char *, const char *,
-				   void *, size_t))
+				   void *, size_t),
+		    ssize_t (*list_fun)(const char *, char *, size_t))
 {
 	int base_size = sizeof(acl_ea_header) + 3 * sizeof(acl_ea_entry);
+	int has = __ACL_HAS_ACCESS | __ACL_HAS_DEFAULT;
+	char names[__ACL_NAMES_SIZE];
+	ssize_t size;
 	int retval;
 
-	retval = fun(path_p, ACL_EA_ACCESS, NULL, 0);
-	if (retval < 0 && errno != ENOATTR && errno != ENODATA)
-		return -1;
-	if (retval > base_size)
-		return 1;
-	retval = fun(path_p, ACL_EA_DEFAULT, NULL, 0);
-	if (retval < 0 && errno != ENOATTR && errno != ENODATA)
-		return -1;
-	if (retval >= base_size)
-		return 1;
+	/* Most files have no ACLs: one listxattr() call tells. */
+	size = list_fun(path_p, names, sizeof(names));
+	if (size >= 0) {
+		has = __acl_names(names, size);
+		if (!has)
+			return 0;
+	}
+
+	if (has & __ACL_HAS_ACCESS) {
+		retval = fun(path_p, ACL_EA_ACCESS, NULL, 0);
+		if (retval < 0 && errno != ENOATTR && errno != ENODATA)
+			return -1;
+		if (retval > base_size)
+			return 1;
+	}
+	if (has & __ACL_HAS_DEFAULT) {
+		retval = fun(path_p, ACL_EA_DEFAULT, NULL, 0);
+		if (retval < 0 && errno != ENOATTR && errno != ENODATA)
+			return -1;
+		if (retval >= base_size)
+			return 1;
+	}
 	return 0;
 }
@@ -1,3 +1,11 @@
 int __acl_extended_file(const char *path_p,
 			ssize_t (*)(const char *, const char *,
-				    void *, size_t));
+				    void *, size_t),
+			ssize_t (*)(const char *, char *, size_t));
+
+/* Size of the buffer for listing attribute names on the stack */
+#define __ACL_NAMES_SIZE	512
+
+#define __ACL_HAS_ACCESS	1
+#define __ACL_HAS_DEFAULT	2
+int __acl_names(const char *names, ssize_t size);
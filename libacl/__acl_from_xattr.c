@@ -77,7 +77,7 @@ __acl_from_xattr(const char *ext_acl_p, size_t size)
 				break;
 
 			default:
-				error = EINVAL;
+				errno = EINVAL;
 				goto fail;
 		}
 		ext_entry_p++;
@@ -87,7 +87,9 @@ __acl_from_xattr(const char *ext_acl_p, size_t size)
 	return int2ext(acl_obj_p);
 
 fail:
+	error = errno;
 	__acl_free_acl_obj(acl_obj_p);
+	errno = error;
 	return NULL;
 }
 
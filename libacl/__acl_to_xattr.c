@@ -27,18 +27,17 @@
 #include "acl_ea.h"
 
 
-char *
-__acl_to_xattr(const acl_obj *acl_obj_p, size_t *size)
+/*
+ * Store the extended attribute representation of an ACL in EXT_ACL_P,
+ * which must be acl_ea_size(acl_obj_p->aused) bytes big.
+ */
+void
+__acl_to_xattr_buf(const acl_obj *acl_obj_p, void *ext_acl_p)
 {
 	const acl_entry_obj *entry_obj_p;
-	acl_ea_header *ext_header_p;
+	acl_ea_header *ext_header_p = ext_acl_p;
 	acl_ea_entry *ext_ent_p;
 
-	*size = sizeof(acl_ea_header) + acl_obj_p->aused * sizeof(acl_ea_entry);
-	ext_header_p = (acl_ea_header *)malloc(*size);
-	if (!ext_header_p)
-		return NULL;
-
 	ext_header_p->a_version = cpu_to_le32(ACL_EA_VERSION);
 	ext_ent_p = (acl_ea_entry *)(ext_header_p+1);
 	FOREACH_ACL_ENTRY(entry_obj_p, acl_obj_p) {
@@ -58,6 +57,17 @@ __acl_to_xattr(const acl_obj *acl_obj_p, size_t *size)
 		}
 		ext_ent_p++;
 	}
-	return (char *)ext_header_p;
 }
 
+char *
+__acl_to_xattr(const acl_obj *acl_obj_p, size_t *size)
+{
+	char *ext_acl_p;
+
+	*size = sizeof(acl_ea_header) + acl_obj_p->aused * sizeof(acl_ea_entry);
+	ext_acl_p = malloc(*size);
+	if (!ext_acl_p)
+		return NULL;
+	__acl_to_xattr_buf(acl_obj_p, ext_acl_p);
+	return ext_acl_p;
+}
@@ -1 +1,2 @@
 char *__acl_to_xattr(const acl_obj *acl_obj_p, size_t *size);
+void __acl_to_xattr_buf(const acl_obj *acl_obj_p, void *ext_acl_p);
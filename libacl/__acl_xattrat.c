@@ -0,0 +1,246 @@
+/*
+  File: __acl_xattrat.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <attr/xattr.h>
+#include "libacl.h"
+#include "__acl_xattrat.h"
+
+/*
+ * Linux 6.13 added system calls for accessing extended attributes
+ * relative to a directory file descriptor. They have the same numbers
+ * on all architectures that use the common system call table.
+ */
+#if !defined(__NR_getxattrat) && \
+    ((defined(__x86_64__) && !defined(__ILP32__)) || defined(__i386__) || \
+     defined(__aarch64__) || defined(__arm__) || defined(__riscv) || \
+     defined(__powerpc__) || defined(__s390__) || defined(__loongarch__))
+# define __NR_setxattrat	463
+# define __NR_getxattrat	464
+# define __NR_listxattrat	465
+# define __NR_removexattrat	466
+#endif
+
+#ifdef __NR_getxattrat
+struct __acl_xattr_args {
+	uint64_t	value;
+	uint32_t	size;
+	uint32_t	flags;
+};
+
+/* Set once the running kernel turned out not to have the system calls. */
+static int no_xattrat;
+
+/*
+ * Check if a failed *xattrat system call should be retried through
+ * /proc/self/fd/. This is the case when the kernel does not know the
+ * system call, and for O_PATH file descriptors, which the system calls
+ * do not accept.
+ */
+static int
+xattrat_fallback(int dirfd, const char *path_p, int flags)
+{
+	if (errno == ENOSYS) {
+		no_xattrat = 1;
+		return 1;
+	}
+#ifdef O_PATH
+	if (errno == EBADF && !*path_p && (flags & AT_EMPTY_PATH)) {
+		int fl = fcntl(dirfd, F_GETFL);
+
+		if (fl != -1 && (fl & O_PATH))
+			return 1;
+		errno = EBADF;
+	}
+#endif
+	return 0;
+}
+#endif
+
+/*
+ * Without the *xattrat system calls, refer to the object through the
+ * /proc/self/fd/ symlink of DIRFD. If a path needs to be constructed,
+ * it is returned in *BUF_P, which the caller must free.
+ */
+static const char *
+proc_path(int dirfd, const char *path_p, int flags, char **buf_p)
+{
+	char *buf;
+
+	*buf_p = NULL;
+	if (flags & ~(AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!*path_p) {
+		if (!(flags & AT_EMPTY_PATH)) {
+			errno = ENOENT;
+			return NULL;
+		}
+		if (dirfd == AT_FDCWD)
+			return ".";
+	} else if (*path_p == '/' || dirfd == AT_FDCWD)
+		return path_p;
+
+	buf = malloc(sizeof("/proc/self/fd//") + 3 * sizeof(int) +
+		     strlen(path_p));
+	if (!buf)
+		return NULL;
+	if (*path_p)
+		sprintf(buf, "/proc/self/fd/%d/%s", dirfd, path_p);
+	else
+		sprintf(buf, "/proc/self/fd/%d", dirfd);
+	*buf_p = buf;
+	return buf;
+}
+
+/*
+ * With AT_EMPTY_PATH, the magic symlink in /proc/self/fd/ must be
+ * followed to get to the object DIRFD refers to.
+ */
+#define proc_nofollow(path_p, flags) \
+	(*(path_p) && ((flags) & AT_SYMLINK_NOFOLLOW))
+
+ssize_t
+__acl_getxattrat(int dirfd, const char *path_p, int flags,
+		 const char *name, void *value, size_t size)
+{
+	const char *path;
+	char *buf;
+	ssize_t retval;
+
+#ifdef __NR_getxattrat
+	if (!no_xattrat) {
+		struct __acl_xattr_args args = {
+			.value = (uintptr_t)value,
+			.size = size,
+		};
+
+		retval = syscall(__NR_getxattrat, dirfd, path_p, flags,
+				 name, &args, sizeof(args));
+		if (retval != -1 ||
+		    !xattrat_fallback(dirfd, path_p, flags))
+			return retval;
+	}
+#endif
+	path = proc_path(dirfd, path_p, flags, &buf);
+	if (!path)
+		return -1;
+	if (proc_nofollow(path_p, flags))
+		retval = lgetxattr(path, name, value, size);
+	else
+		retval = getxattr(path, name, value, size);
+	free(buf);
+	return retval;
+}
+
+int
+__acl_setxattrat(int dirfd, const char *path_p, int flags,
+		 const char *name, const void *value, size_t size)
+{
+	const char *path;
+	char *buf;
+	int retval;
+
+#ifdef __NR_getxattrat
+	if (!no_xattrat) {
+		struct __acl_xattr_args args = {
+			.value = (uintptr_t)value,
+			.size = size,
+		};
+
+		retval = syscall(__NR_setxattrat, dirfd, path_p, flags,
+				 name, &args, sizeof(args));
+		if (retval != -1 ||
+		    !xattrat_fallback(dirfd, path_p, flags))
+			return retval;
+	}
+#endif
+	path = proc_path(dirfd, path_p, flags, &buf);
+	if (!path)
+		return -1;
+	if (proc_nofollow(path_p, flags))
+		retval = lsetxattr(path, name, value, size, 0);
+	else
+		retval = setxattr(path, name, value, size, 0);
+	free(buf);
+	return retval;
+}
+
+int
+__acl_removexattrat(int dirfd, const char *path_p, int flags,
+		    const char *name)
+{
+	const char *path;
+	char *buf;
+	int retval;
+
+#ifdef __NR_getxattrat
+	if (!no_xattrat) {
+		retval = syscall(__NR_removexattrat, dirfd, path_p, flags,
+				 name);
+		if (retval != -1 ||
+		    !xattrat_fallback(dirfd, path_p, flags))
+			return retval;
+	}
+#endif
+	path = proc_path(dirfd, path_p, flags, &buf);
+	if (!path)
+		return -1;
+	if (proc_nofollow(path_p, flags))
+		retval = lremovexattr(path, name);
+	else
+		retval = removexattr(path, name);
+	free(buf);
+	return retval;
+}
+
+ssize_t
+__acl_listxattrat(int dirfd, const char *path_p, int flags,
+		  char *list, size_t size)
+{
+	const char *path;
+	char *buf;
+	ssize_t retval;
+
+#ifdef __NR_getxattrat
+	if (!no_xattrat) {
+		retval = syscall(__NR_listxattrat, dirfd, path_p, flags,
+				 list, size);
+		if (retval != -1 ||
+		    !xattrat_fallback(dirfd, path_p, flags))
+			return retval;
+	}
+#endif
+	path = proc_path(dirfd, path_p, flags, &buf);
+	if (!path)
+		return -1;
+	if (proc_nofollow(path_p, flags))
+		retval = llistxattr(path, list, size);
+	else
+		retval = listxattr(path, list, size);
+	free(buf);
+	return retval;
+}
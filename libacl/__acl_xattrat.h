@@ -0,0 +1,8 @@
+ssize_t __acl_getxattrat(int dirfd, const char *path_p, int flags,
+			 const char *name, void *value, size_t size);
+int __acl_setxattrat(int dirfd, const char *path_p, int flags,
+		     const char *name, const void *value, size_t size);
+int __acl_removexattrat(int dirfd, const char *path_p, int flags,
+			const char *name);
+ssize_t __acl_listxattrat(int dirfd, const char *path_p, int flags,
+			  char *list, size_t size);
@@ -0,0 +1,445 @@
+/*
+  File: acl_batch.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <attr/xattr.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+#include "__acl_from_xattr.h"
+#include "__acl_to_xattr.h"
+#include "uring.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+/* Number of worker threads of ACL_BATCH_THREADS */
+#define BATCH_THREADS		8
+
+/* Number of requests in flight with ACL_BATCH_URING */
+#define BATCH_DEPTH		64
+
+/* ACLs up to this size are read with a single request */
+#define BATCH_BUFFER_SIZE	acl_ea_size(32)
+
+static void
+get_one(struct acl_batch *item)
+{
+	item->acl = acl_get_fileat(item->dirfd, item->path_p, item->type,
+				   item->flags);
+	item->error = item->acl ? 0 : errno;
+}
+
+static void
+set_one(struct acl_batch *item)
+{
+	if (acl_set_fileat(item->dirfd, item->path_p, item->type, item->acl,
+			   item->flags) != 0)
+		item->error = errno;
+	else
+		item->error = 0;
+}
+
+static int
+count_errors(struct acl_batch *batch, size_t count)
+{
+	int errors = 0;
+	size_t n;
+
+	for (n = 0; n < count; n++)
+		if (batch[n].error)
+			errors++;
+	return errors;
+}
+
+static void
+run_sync(struct acl_batch *batch, size_t count,
+	 void (*fun)(struct acl_batch *))
+{
+	size_t n;
+
+	for (n = 0; n < count; n++)
+		fun(&batch[n]);
+}
+
+struct batch_threads {
+	struct acl_batch *batch;
+	size_t count;
+	size_t next;
+	void (*fun)(struct acl_batch *);
+};
+
+static void *
+batch_worker(void *arg)
+{
+	struct batch_threads *bt = arg;
+
+	for(;;) {
+		size_t n = __atomic_fetch_add(&bt->next, 1, __ATOMIC_RELAXED);
+
+		if (n >= bt->count)
+			break;
+		bt->fun(&bt->batch[n]);
+	}
+	return NULL;
+}
+
+static void
+run_threads(struct acl_batch *batch, size_t count,
+	    void (*fun)(struct acl_batch *))
+{
+	struct batch_threads bt = {
+		.batch = batch,
+		.count = count,
+		.fun = fun,
+	};
+	pthread_t threads[BATCH_THREADS - 1];
+	int n, started = 0;
+
+	/* The calling thread is one of the workers. */
+	for (n = 0; n < BATCH_THREADS - 1 && n + 1 < count; n++) {
+		if (pthread_create(&threads[n], NULL, batch_worker, &bt) != 0)
+			break;
+		started++;
+	}
+	batch_worker(&bt);
+	for (n = 0; n < started; n++)
+		pthread_join(threads[n], NULL);
+}
+
+struct batch_slot {
+	struct acl_batch *item;
+	char *path;  /* path relative to the current directory */
+	char *value;
+	size_t size;
+};
+
+/*
+ * io_uring only accepts paths relative to the current working directory;
+ * reach other objects through /proc/self/fd/.
+ */
+static const char *
+slot_path(struct batch_slot *slot)
+{
+	struct acl_batch *item = slot->item;
+
+	if (item->dirfd == AT_FDCWD || item->path_p[0] == '/')
+		return item->path_p;
+	slot->path = malloc(sizeof("/proc/self/fd//") + 3 * sizeof(int) +
+			    strlen(item->path_p));
+	if (slot->path)
+		sprintf(slot->path, "/proc/self/fd/%d/%s", item->dirfd,
+			item->path_p);
+	return slot->path;
+}
+
+/*
+ * The file has no ACL attribute of the requested type: as in
+ * acl_get_file(), derive the ACL from the file mode.
+ */
+static void
+get_missing(struct acl_batch *item)
+{
+	struct stat st;
+
+	if (fstatat(item->dirfd, item->path_p, &st, item->flags) != 0)
+		item->error = errno;
+	else if (item->type == ACL_TYPE_DEFAULT) {
+		if (S_ISDIR(st.st_mode)) {
+			item->acl = acl_init(0);
+			item->error = item->acl ? 0 : errno;
+		} else
+			item->error = EACCES;
+	} else {
+		item->acl = acl_from_mode(st.st_mode);
+		item->error = item->acl ? 0 : errno;
+	}
+}
+
+struct batch_engine {
+	int uring_ops;
+	int (*synchronous)(struct acl_batch *);
+	int (*start)(struct uring *, struct batch_slot *, uint64_t);
+	void (*finish)(struct batch_slot *, int);
+	void (*fun)(struct acl_batch *);
+};
+
+static int
+get_synchronous(struct acl_batch *item)
+{
+	return item->flags || (item->type != ACL_TYPE_ACCESS &&
+			       item->type != ACL_TYPE_DEFAULT);
+}
+
+static int
+start_get(struct uring *ring, struct batch_slot *slot, uint64_t user_data)
+{
+	const char *path = slot_path(slot);
+	const char *name;
+
+	if (!path)
+		return -1;
+	name = (slot->item->type == ACL_TYPE_ACCESS) ?
+		ACL_EA_ACCESS : ACL_EA_DEFAULT;
+	if (!slot->value) {
+		slot->value = malloc(BATCH_BUFFER_SIZE);
+		if (!slot->value)
+			return -1;
+	}
+	return uring_getxattr(ring, path, name, slot->value,
+			      BATCH_BUFFER_SIZE, user_data);
+}
+
+static void
+finish_get(struct batch_slot *slot, int res)
+{
+	struct acl_batch *item = slot->item;
+
+	if (res > 0) {
+		item->acl = __acl_from_xattr(slot->value, res);
+		item->error = item->acl ? 0 : errno;
+	} else if (res == 0 || res == -ENODATA)
+		get_missing(item);
+	else if (res == -ERANGE)
+		get_one(item);  /* too big for the buffer */
+	else
+		item->error = -res;
+}
+
+static const struct batch_engine get_engine = {
+	.uring_ops = URING_GETXATTR,
+	.synchronous = get_synchronous,
+	.start = start_get,
+	.finish = finish_get,
+	.fun = get_one,
+};
+
+/* Default ACLs need a check that the file is a directory first. */
+static int
+set_synchronous(struct acl_batch *item)
+{
+	return item->flags || item->type != ACL_TYPE_ACCESS;
+}
+
+static int
+start_set(struct uring *ring, struct batch_slot *slot, uint64_t user_data)
+{
+	acl_obj *acl_obj_p = ext2int(acl, slot->item->acl);
+	const char *path;
+
+	if (!acl_obj_p)
+		return -1;
+	path = slot_path(slot);
+	if (!path)
+		return -1;
+	slot->value = __acl_to_xattr(acl_obj_p, &slot->size);
+	if (!slot->value)
+		return -1;
+	if (uring_setxattr(ring, path, ACL_EA_ACCESS, slot->value,
+			   slot->size, 0, user_data) != 0) {
+		free(slot->value);
+		slot->value = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+finish_set(struct batch_slot *slot, int res)
+{
+	slot->item->error = (res < 0) ? -res : 0;
+	free(slot->value);
+	slot->value = NULL;
+}
+
+static const struct batch_engine set_engine = {
+	.uring_ops = URING_SETXATTR,
+	.synchronous = set_synchronous,
+	.start = start_set,
+	.finish = finish_set,
+	.fun = set_one,
+};
+
+static void
+finish_slot(const struct batch_engine *engine, struct batch_slot *slot,
+	    int res)
+{
+	engine->finish(slot, res);
+	free(slot->path);
+	slot->path = NULL;
+	slot->item = NULL;
+}
+
+/*
+ * Keep up to BATCH_DEPTH requests in flight. Items that io_uring cannot
+ * handle are processed synchronously in between. Returns -1 if io_uring
+ * is not available; nothing has been done then.
+ */
+static int
+run_uring(struct acl_batch *batch, size_t count,
+	  const struct batch_engine *engine)
+{
+	struct batch_slot slots[BATCH_DEPTH];
+	unsigned int free_slots[BATCH_DEPTH], nr_free = BATCH_DEPTH;
+	unsigned int in_flight = 0, n;
+	struct uring *ring;
+	size_t next = 0;
+	uint64_t user_data;
+	int res;
+
+	ring = uring_init(BATCH_DEPTH);
+	if (!ring || !uring_supports(ring, engine->uring_ops)) {
+		uring_exit(ring);
+		return -1;
+	}
+	memset(slots, 0, sizeof(slots));
+	for (n = 0; n < BATCH_DEPTH; n++)
+		free_slots[n] = BATCH_DEPTH - 1 - n;
+
+	while (next < count || in_flight) {
+		struct batch_slot *slot;
+
+		while (next < count && nr_free) {
+			struct acl_batch *item = &batch[next++];
+
+			if (engine->synchronous(item)) {
+				engine->fun(item);
+				continue;
+			}
+			n = free_slots[--nr_free];
+			slot = &slots[n];
+			slot->item = item;
+			if (engine->start(ring, slot, n) != 0) {
+				item->error = errno;
+				free(slot->path);
+				slot->path = NULL;
+				slot->item = NULL;
+				free_slots[nr_free++] = n;
+				continue;
+			}
+			in_flight++;
+		}
+		if (!in_flight)
+			continue;
+		if (uring_submit(ring) != 0 ||
+		    uring_wait(ring, &user_data, &res) != 0)
+			break;
+		in_flight--;
+		finish_slot(engine, &slots[user_data], res);
+		free_slots[nr_free++] = user_data;
+	}
+
+	if (in_flight) {
+		int error = errno;
+		unsigned int accepted = in_flight - uring_unsubmitted(ring);
+
+		/*
+		 * The kernel may still access the buffers of the requests it
+		 * has accepted, so wait for them to complete; the others
+		 * never will. If waiting fails as well, the buffers of the
+		 * remaining requests are leaked rather than freed.
+		 */
+		while (accepted && uring_wait(ring, &user_data, &res) == 0) {
+			accepted--;
+			finish_slot(engine, &slots[user_data], res);
+		}
+		for (n = 0; n < BATCH_DEPTH; n++) {
+			if (!slots[n].item)
+				continue;
+			slots[n].item->error = error;
+			if (accepted)
+				slots[n].value = NULL;
+			else
+				free(slots[n].path);
+		}
+
+		/* Do the rest here. */
+		for (; next < count; next++)
+			engine->fun(&batch[next]);
+	}
+	uring_exit(ring);
+	for (n = 0; n < BATCH_DEPTH; n++)
+		free(slots[n].value);
+	return 0;
+}
+
+static int
+run_batch(struct acl_batch *batch, size_t count, int engine,
+	  void (*fun)(struct acl_batch *))
+{
+	switch(engine) {
+		case ACL_BATCH_SYNC:
+			run_sync(batch, count, fun);
+			break;
+		case ACL_BATCH_THREADS:
+			run_threads(batch, count, fun);
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+	return count_errors(batch, count);
+}
+
+/*
+ * Get the ACLs of COUNT files. The engine determines how the requests
+ * are issued: ACL_BATCH_SYNC processes one file after the other,
+ * ACL_BATCH_THREADS uses a small pool of threads, and ACL_BATCH_URING
+ * queues the requests with io_uring; without kernel support, it falls
+ * back to ACL_BATCH_THREADS. Returns the number of items that failed.
+ */
+int
+acl_get_files(struct acl_batch *batch, size_t count, int engine)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		batch[n].acl = NULL;
+		batch[n].error = 0;
+	}
+	if (engine == ACL_BATCH_URING) {
+		if (run_uring(batch, count, &get_engine) == 0)
+			return count_errors(batch, count);
+		engine = ACL_BATCH_THREADS;
+	}
+	return run_batch(batch, count, engine, get_one);
+}
+
+/*
+ * Set the ACLs of COUNT files. See acl_get_files().
+ */
+int
+acl_set_files(struct acl_batch *batch, size_t count, int engine)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++)
+		batch[n].error = 0;
+	if (engine == ACL_BATCH_URING) {
+		if (run_uring(batch, count, &set_engine) == 0)
+			return count_errors(batch, count);
+		engine = ACL_BATCH_THREADS;
+	}
+	return run_batch(batch, count, engine, set_one);
+}
+
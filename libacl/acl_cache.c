@@ -0,0 +1,344 @@
+/*
+  File: acl_cache.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+
+/*
+ * An ACL cache maps (device, inode, status change time, ACL type) to the
+ * ACL of the file. The ACL of a file cannot change without changing its
+ * status change time, so entries never need to be invalidated; they are
+ * evicted in least recently used order.
+ *
+ * This only holds if the change gets a new status change time, though: on
+ * file systems with coarse time stamps, two changes within the same clock
+ * tick get the same one. Like git does with "racily clean" index entries,
+ * ACLs of files whose status change time is not at least RACY_SEC in the
+ * past are not cached, so any later change gets a different time stamp.
+ *
+ * The cached ACLs are never handed out: callers get a private copy, which
+ * costs an allocation and a copy of the entries, but neither a system call
+ * nor decoding and sorting the entries again.
+ */
+
+/* Coarsest time stamp granularity of file systems that support ACLs */
+#define RACY_SEC	1
+
+struct cache_entry {
+	struct cache_entry *hash_next;
+	struct cache_entry *lru_prev, *lru_next;
+	unsigned int hash;
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+	acl_type_t type;
+	acl_obj *acl_obj_p;
+};
+
+struct acl_cache {
+	pthread_mutex_t lock;
+	struct cache_entry **hash;
+	unsigned int hash_mask;
+	struct cache_entry *entries, *free;
+	struct cache_entry lru;		/* most recently used first */
+	unsigned long hits, misses;
+};
+
+static unsigned int
+cache_hash(struct acl_cache *cache, const struct stat *st, acl_type_t type)
+{
+	unsigned long hash = st->st_ino * 31 + st->st_dev;
+
+	hash = hash * 31 + type;
+	return (hash ^ (hash >> 16)) & cache->hash_mask;
+}
+
+static int
+cache_match(const struct cache_entry *entry, const struct stat *st,
+	    acl_type_t type)
+{
+	return entry->ino == st->st_ino && entry->dev == st->st_dev &&
+	       entry->type == type &&
+	       entry->ctime.tv_sec == st->st_ctim.tv_sec &&
+	       entry->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/*
+ * Could the file change again without changing its status change time?
+ * Status change times in the future are treated the same way.
+ */
+static int
+cache_racy(const struct stat *st)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_REALTIME, &now) != 0)
+		return 1;
+	now.tv_sec -= RACY_SEC;
+	return st->st_ctim.tv_sec > now.tv_sec ||
+	       (st->st_ctim.tv_sec == now.tv_sec &&
+		st->st_ctim.tv_nsec > now.tv_nsec);
+}
+
+static void
+lru_unlink(struct cache_entry *entry)
+{
+	entry->lru_prev->lru_next = entry->lru_next;
+	entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+static void
+lru_add(struct acl_cache *cache, struct cache_entry *entry)
+{
+	entry->lru_prev = &cache->lru;
+	entry->lru_next = cache->lru.lru_next;
+	entry->lru_next->lru_prev = entry;
+	cache->lru.lru_next = entry;
+}
+
+static struct cache_entry **
+cache_find(struct acl_cache *cache, const struct stat *st, acl_type_t type)
+{
+	struct cache_entry **pos;
+
+	pos = &cache->hash[cache_hash(cache, st, type)];
+	while (*pos && !cache_match(*pos, st, type))
+		pos = &(*pos)->hash_next;
+	return pos;
+}
+
+/*
+ * Look up an ACL in the cache. Returns 1 and stores a copy of the ACL (or
+ * NULL if it cannot be copied) in *ACL_P if the ACL is cached, and 0 if it
+ * is not.
+ */
+static int
+cache_lookup(struct acl_cache *cache, const struct stat *st, acl_type_t type,
+	     acl_t *acl_p)
+{
+	struct cache_entry *entry;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = *cache_find(cache, st, type);
+	if (entry) {
+		lru_unlink(entry);
+		lru_add(cache, entry);
+		cache->hits++;
+		*acl_p = acl_dup(int2ext(entry->acl_obj_p));
+	} else
+		cache->misses++;
+	pthread_mutex_unlock(&cache->lock);
+	return entry != NULL;
+}
+
+/*
+ * Add a copy of an ACL to the cache, evicting the least recently used
+ * entry if necessary, unless the file changed too recently. Returns ACL,
+ * which stays private to the caller.
+ */
+static acl_t
+cache_insert(struct acl_cache *cache, const struct stat *st,
+	     acl_type_t type, acl_t acl)
+{
+	struct cache_entry *entry, **pos;
+	acl_obj *acl_obj_p, *evicted = NULL;
+	acl_t copy;
+
+	if (cache_racy(st))
+		return acl;
+	copy = acl_dup(acl);
+	if (!copy)
+		return acl;  /* not cached */
+	acl_obj_p = ext2int(acl, copy);
+
+	pthread_mutex_lock(&cache->lock);
+	pos = cache_find(cache, st, type);
+	if (*pos) {
+		/* Another thread got there first. */
+		pthread_mutex_unlock(&cache->lock);
+		acl_free(copy);
+		return acl;
+	}
+	entry = cache->free;
+	if (entry)
+		cache->free = entry->hash_next;
+	else {
+		struct cache_entry **evict_pos;
+
+		entry = cache->lru.lru_prev;
+		lru_unlink(entry);
+		evict_pos = &cache->hash[entry->hash];
+		while (*evict_pos != entry)
+			evict_pos = &(*evict_pos)->hash_next;
+		*evict_pos = entry->hash_next;
+		evicted = entry->acl_obj_p;
+
+		/* The evicted entry may have been in the same chain. */
+		pos = cache_find(cache, st, type);
+	}
+	entry->hash = cache_hash(cache, st, type);
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->ctime = st->st_ctim;
+	entry->type = type;
+	entry->acl_obj_p = acl_obj_p;
+	entry->hash_next = NULL;
+	*pos = entry;
+	lru_add(cache, entry);
+	pthread_mutex_unlock(&cache->lock);
+
+	if (evicted)
+		acl_free(int2ext(evicted));
+	return acl;
+}
+
+/*
+ * Create a cache for up to SIZE ACLs.
+ */
+struct acl_cache *
+acl_cache_create(size_t size)
+{
+	struct acl_cache *cache;
+	unsigned int buckets = 1;
+	size_t n;
+
+	if (size == 0 || size > (1U << 30)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	while (buckets < size)
+		buckets <<= 1;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+	cache->hash = calloc(buckets, sizeof(*cache->hash));
+	cache->entries = malloc(size * sizeof(*cache->entries));
+	if (!cache->hash || !cache->entries) {
+		free(cache->hash);
+		free(cache->entries);
+		free(cache);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->hash_mask = buckets - 1;
+	for (n = 0; n < size; n++)
+		cache->entries[n].hash_next = n + 1 < size ?
+					      &cache->entries[n + 1] : NULL;
+	cache->free = cache->entries;
+	cache->lru.lru_prev = cache->lru.lru_next = &cache->lru;
+	return cache;
+}
+
+/*
+ * Destroy a cache. The ACLs returned from it are private to the callers,
+ * and remain valid.
+ */
+void
+acl_cache_destroy(struct acl_cache *cache)
+{
+	struct cache_entry *entry;
+
+	if (!cache)
+		return;
+	for (entry = cache->lru.lru_next; entry != &cache->lru;
+	     entry = entry->lru_next)
+		acl_free(int2ext(entry->acl_obj_p));
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->entries);
+	free(cache->hash);
+	free(cache);
+}
+
+/*
+ * Like acl_get_file(), but return the ACL from the cache if the file has
+ * not changed since it was cached. ST_P is the status of the file, or
+ * NULL. The caller owns the ACL returned, like with acl_get_file().
+ */
+acl_t
+acl_cache_get(struct acl_cache *cache, const char *path_p, acl_type_t type,
+	      const struct stat *st_p)
+{
+	struct stat st;
+	acl_t acl;
+
+	if (!cache) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!st_p) {
+		if (stat(path_p, &st) != 0)
+			return NULL;
+		st_p = &st;
+	}
+	if (cache_lookup(cache, st_p, type, &acl))
+		return acl;
+	acl = acl_get_file_st(path_p, type, st_p);
+	if (!acl)
+		return NULL;
+	return cache_insert(cache, st_p, type, acl);
+}
+
+/*
+ * Like acl_get_fd(), but return the ACL from the cache if the file has
+ * not changed since it was cached.
+ */
+acl_t
+acl_cache_get_fd(struct acl_cache *cache, int fd, const struct stat *st_p)
+{
+	struct stat st;
+	acl_t acl;
+
+	if (!cache) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!st_p) {
+		if (fstat(fd, &st) != 0)
+			return NULL;
+		st_p = &st;
+	}
+	if (cache_lookup(cache, st_p, ACL_TYPE_ACCESS, &acl))
+		return acl;
+	acl = acl_get_fd_st(fd, st_p);
+	if (!acl)
+		return NULL;
+	return cache_insert(cache, st_p, ACL_TYPE_ACCESS, acl);
+}
+
+/*
+ * Report how many lookups were answered from the cache, and how many
+ * were not.
+ */
+void
+acl_cache_stats(struct acl_cache *cache, unsigned long *hits_p,
+		unsigned long *misses_p)
+{
+	pthread_mutex_lock(&cache->lock);
+	if (hits_p)
+		*hits_p = cache->hits;
+	if (misses_p)
+		*misses_p = cache->misses;
+	pthread_mutex_unlock(&cache->lock);
+}
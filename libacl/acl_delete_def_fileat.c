@@ -0,0 +1,43 @@
+/*
+  File: acl_delete_def_fileat.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <attr/xattr.h>
+#include "libacl.h"
+#include "__acl_xattrat.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+#include "config.h"
+
+
+/*
+ * Like acl_delete_def_file(), but PATH_P is relative to DIRFD. FLAGS
+ * may contain AT_SYMLINK_NOFOLLOW and AT_EMPTY_PATH.
+ */
+int
+acl_delete_def_fileat(int dirfd, const char *path_p, int flags)
+{
+	int error;
+
+	error = __acl_removexattrat(dirfd, path_p, flags, ACL_EA_DEFAULT);
+	if (error < 0 && errno != ENOATTR && errno != ENODATA)
+		return -1;
+	return 0;
+}
+
@@ -25,24 +25,38 @@
 
 #include "byteorder.h"
 #include "acl_ea.h"
+#include "__acl_extended_file.h"
 
 
 int
 acl_extended_fd(int fd)
 {
 	int base_size = sizeof(acl_ea_header) + 3 * sizeof(acl_ea_entry);
+	int has = __ACL_HAS_ACCESS | __ACL_HAS_DEFAULT;
+	char names[__ACL_NAMES_SIZE];
+	ssize_t size;
 	int retval;
 
-	retval = fgetxattr(fd, ACL_EA_ACCESS, NULL, 0);
-	if (retval < 0 && errno != ENOATTR && errno != ENODATA)
-		return -1;
-	if (retval > base_size)
-		return 1;
-	retval = fgetxattr(fd, ACL_EA_DEFAULT, NULL, 0);
-	if (retval < 0 && errno != ENOATTR && errno != ENODATA)
-		return -1;
-	if (retval >= base_size)
-		return 1;
+	size = flistxattr(fd, names, sizeof(names));
+	if (size >= 0) {
+		has = __acl_names(names, size);
+		if (!has)
+			return 0;
+	}
+
+	if (has & __ACL_HAS_ACCESS) {
+		retval = fgetxattr(fd, ACL_EA_ACCESS, NULL, 0);
+		if (retval < 0 && errno != ENOATTR && errno != ENODATA)
+			return -1;
+		if (retval > base_size)
+			return 1;
+	}
+	if (has & __ACL_HAS_DEFAULT) {
+		retval = fgetxattr(fd, ACL_EA_DEFAULT, NULL, 0);
+		if (retval < 0 && errno != ENOATTR && errno != ENODATA)
+			return -1;
+		if (retval >= base_size)
+			return 1;
+	}
 	return 0;
 }
-
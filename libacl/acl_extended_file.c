@@ -29,6 +29,6 @@
 int
 acl_extended_file(const char *path_p)
 {
-	return __acl_extended_file(path_p, getxattr);
+	return __acl_extended_file(path_p, getxattr, listxattr);
 }
 
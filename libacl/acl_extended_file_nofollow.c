@@ -29,5 +29,5 @@
 int
 acl_extended_file_nofollow(const char *path_p)
 {
-	return __acl_extended_file(path_p, lgetxattr);
+	return __acl_extended_file(path_p, lgetxattr, llistxattr);
 }
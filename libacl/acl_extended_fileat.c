@@ -0,0 +1,67 @@
+/*
+  File: acl_extended_fileat.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <unistd.h>
+#include <attr/xattr.h>
+#include "libacl.h"
+#include "__acl_xattrat.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+#include "__acl_extended_file.h"
+
+
+/*
+ * Like acl_extended_file(), but PATH_P is relative to DIRFD. FLAGS may
+ * contain AT_SYMLINK_NOFOLLOW and AT_EMPTY_PATH.
+ */
+int
+acl_extended_fileat(int dirfd, const char *path_p, int flags)
+{
+	int base_size = sizeof(acl_ea_header) + 3 * sizeof(acl_ea_entry);
+	int has = __ACL_HAS_ACCESS | __ACL_HAS_DEFAULT;
+	char names[__ACL_NAMES_SIZE];
+	ssize_t size;
+	int retval;
+
+	size = __acl_listxattrat(dirfd, path_p, flags, names, sizeof(names));
+	if (size >= 0) {
+		has = __acl_names(names, size);
+		if (!has)
+			return 0;
+	}
+
+	if (has & __ACL_HAS_ACCESS) {
+		retval = __acl_getxattrat(dirfd, path_p, flags, ACL_EA_ACCESS,
+					  NULL, 0);
+		if (retval < 0 && errno != ENOATTR && errno != ENODATA)
+			return -1;
+		if (retval > base_size)
+			return 1;
+	}
+	if (has & __ACL_HAS_DEFAULT) {
+		retval = __acl_getxattrat(dirfd, path_p, flags,
+					  ACL_EA_DEFAULT, NULL, 0);
+		if (retval < 0 && errno != ENOATTR && errno != ENODATA)
+			return -1;
+		if (retval >= base_size)
+			return 1;
+	}
+	return 0;
+}
+
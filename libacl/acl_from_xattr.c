@@ -0,0 +1,34 @@
+/*
+  File: acl_from_xattr.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+#include "__acl_from_xattr.h"
+
+
+/*
+ * Decode the extended attribute representation of an ACL, as stored in
+ * the system.posix_acl_access and system.posix_acl_default attributes.
+ */
+acl_t
+acl_from_xattr(const void *buf_p, size_t size)
+{
+	return __acl_from_xattr(buf_p, size);
+}
+
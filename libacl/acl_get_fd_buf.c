@@ -0,0 +1,68 @@
+/*
+  File: acl_get_fd_buf.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <attr/xattr.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+#include "__acl_from_xattr.h"
+#include "misc.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+
+/*
+ * Like acl_get_fd_st(), but read the extended attribute into the
+ * caller's buffer *BUF_P of *SIZE_P bytes, which is grown as needed.
+ */
+acl_t
+acl_get_fd_buf(int fd, const struct stat *st_p, void **buf_p, size_t *size_p)
+{
+	struct stat st;
+	ssize_t retval;
+
+	if (high_water_alloc(buf_p, size_p, acl_ea_size(16)))
+		return NULL;
+	for(;;) {
+		retval = fgetxattr(fd, ACL_EA_ACCESS, *buf_p, *size_p);
+		if (retval != -1 || errno != ERANGE)
+			break;
+		retval = fgetxattr(fd, ACL_EA_ACCESS, NULL, 0);
+		if (retval <= 0)
+			break;
+		if (high_water_alloc(buf_p, size_p, retval))
+			return NULL;
+	}
+	if (retval > 0) {
+		acl_t acl = __acl_from_xattr(*buf_p, retval);
+		return acl;
+	} else if (retval == 0 || errno == ENOATTR || errno == ENODATA) {
+		if (!st_p) {
+			if (fstat(fd, &st) != 0)
+				return NULL;
+			st_p = &st;
+		}
+		return acl_from_mode(st_p->st_mode);
+	} else
+		return NULL;
+}
+
@@ -0,0 +1,100 @@
+/*
+  File: acl_get_file_buf.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <attr/xattr.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+#include "__acl_from_xattr.h"
+#include "misc.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+
+/*
+ * Like acl_get_file_st(), but read the extended attribute into the
+ * caller's buffer *BUF_P of *SIZE_P bytes, which is grown as needed.
+ * When the buffer is reused, most ACLs are read with a single system
+ * call. *BUF_P may be NULL initially, and must eventually be freed with
+ * free().
+ */
+acl_t
+acl_get_file_buf(const char *path_p, acl_type_t type, const struct stat *st_p,
+		 void **buf_p, size_t *size_p)
+{
+	const char *name;
+	struct stat st;
+	ssize_t retval;
+
+	switch(type) {
+		case ACL_TYPE_ACCESS:
+			name = ACL_EA_ACCESS;
+			break;
+		case ACL_TYPE_DEFAULT:
+			name = ACL_EA_DEFAULT;
+			/* Only directories have default ACLs. */
+			if (st_p && !S_ISDIR(st_p->st_mode)) {
+				errno = EACCES;
+				return NULL;
+			}
+			break;
+		default:
+			errno = EINVAL;
+			return NULL;
+	}
+
+	if (high_water_alloc(buf_p, size_p, acl_ea_size(16)))
+		return NULL;
+	for(;;) {
+		retval = getxattr(path_p, name, *buf_p, *size_p);
+		if (retval != -1 || errno != ERANGE)
+			break;
+		/* The ACL may grow again between the two calls. */
+		retval = getxattr(path_p, name, NULL, 0);
+		if (retval <= 0)
+			break;
+		if (high_water_alloc(buf_p, size_p, retval))
+			return NULL;
+	}
+	if (retval > 0) {
+		acl_t acl = __acl_from_xattr(*buf_p, retval);
+		return acl;
+	} else if (retval == 0 || errno == ENOATTR || errno == ENODATA) {
+		if (!st_p) {
+			if (stat(path_p, &st) != 0)
+				return NULL;
+			st_p = &st;
+		}
+
+		if (type == ACL_TYPE_DEFAULT) {
+			if (S_ISDIR(st_p->st_mode))
+				return acl_init(0);
+			else {
+				errno = EACCES;
+				return NULL;
+			}
+		} else
+			return acl_from_mode(st_p->st_mode);
+	} else
+		return NULL;
+}
+
@@ -0,0 +1,100 @@
+/*
+  File: acl_get_file_pair.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+
+
+/*
+ * Get the access ACL and, for directories, the default ACL of a file,
+ * looking up PATH_P only once: the file is opened with O_PATH, and the
+ * ACLs are read through /proc/self/fd/. *DEFAULT_P is set to NULL if
+ * there is no default ACL. The status of the file is stored in *ST_P
+ * unless ST_P is NULL. FLAGS may contain AT_SYMLINK_NOFOLLOW.
+ */
+int
+acl_get_file_pair(const char *path_p, acl_t *access_p, acl_t *default_p,
+		  struct stat *st_p, int flags)
+{
+	char proc[sizeof("/proc/self/fd/") + 3 * sizeof(int)];
+	const char *path = proc;
+	int open_flags = O_PATH | O_CLOEXEC;
+	acl_t acl = NULL, dacl = NULL;
+	void *buf = NULL;
+	size_t size = 0;
+	struct stat st;
+	int fd, saved_errno;
+
+	if (flags & ~AT_SYMLINK_NOFOLLOW) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (flags & AT_SYMLINK_NOFOLLOW)
+		open_flags |= O_NOFOLLOW;
+	if (!st_p)
+		st_p = &st;
+
+	fd = open(path_p, open_flags);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, st_p) != 0)
+		goto fail;
+	sprintf(proc, "/proc/self/fd/%d", fd);
+
+	acl = acl_get_file_buf(path, ACL_TYPE_ACCESS, st_p, &buf, &size);
+	if (!acl && errno == ENOENT) {
+		/* /proc is not mounted. */
+		path = path_p;
+		acl = acl_get_file_buf(path, ACL_TYPE_ACCESS, st_p,
+				       &buf, &size);
+	}
+	if (!acl)
+		goto fail;
+	if (default_p && S_ISDIR(st_p->st_mode)) {
+		dacl = acl_get_file_buf(path, ACL_TYPE_DEFAULT, st_p,
+					&buf, &size);
+		if (!dacl)
+			goto fail;
+		if (acl_entries(dacl) == 0) {
+			acl_free(dacl);
+			dacl = NULL;
+		}
+	}
+	free(buf);
+	close(fd);
+	*access_p = acl;
+	if (default_p)
+		*default_p = dacl;
+	return 0;
+
+fail:
+	saved_errno = errno;
+	if (acl)
+		acl_free(acl);
+	free(buf);
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
@@ -0,0 +1,158 @@
+/*
+  File: acl_minimize.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <acl/libacl.h>
+#include "libacl.h"
+
+
+static void
+remove_entry_obj(acl_obj *acl_obj_p, acl_entry_obj *entry_obj_p)
+{
+	if (acl_obj_p->acurr == entry_obj_p)
+		acl_obj_p->acurr = acl_obj_p->acurr->eprev;
+	entry_obj_p->eprev->enext = entry_obj_p->enext;
+	entry_obj_p->enext->eprev = entry_obj_p->eprev;
+	free_obj_p(entry_obj_p);
+	acl_obj_p->aused--;
+}
+
+/*
+ * Does every group class entry other than ENTRY_OBJ_P grant at least PERM?
+ */
+static int
+group_class_covers(acl_obj *acl_obj_p, acl_entry_obj *entry_obj_p,
+		   permset_t mask, permset_t perm)
+{
+	acl_entry_obj *other_p;
+
+	FOREACH_ACL_ENTRY(other_p, acl_obj_p) {
+		if (other_p == entry_obj_p)
+			continue;
+		if (other_p->etag != ACL_GROUP_OBJ &&
+		    other_p->etag != ACL_GROUP)
+			continue;
+		if ((other_p->eperm.sperm & mask & perm) != perm)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Remove the entries of an access ACL that do not change which
+ * permissions any process is granted, whatever groups it is a member
+ * of, and narrow the mask to the permissions it lets through. Returns
+ * 1 if the ACL was changed, and 0 if it already was minimal.
+ */
+int
+acl_minimize(acl_t acl)
+{
+	acl_obj *acl_obj_p = ext2int(acl, acl);
+	acl_entry_obj *entry_obj_p, *next_p;
+	acl_entry_obj *group_obj_p = NULL, *mask_obj_p = NULL;
+	permset_t mask = ACL_PERM_NONE, other = ACL_PERM_NONE;
+	permset_t perm, used = ACL_PERM_NONE;
+	int named = 0, uniform = 1, changed = 0;
+
+	if (!acl_obj_p)
+		return -1;
+	if (acl_valid(acl) != 0)
+		return -1;
+	FOREACH_ACL_ENTRY(entry_obj_p, acl_obj_p) {
+		switch(entry_obj_p->etag) {
+			case ACL_GROUP_OBJ:
+				group_obj_p = entry_obj_p;
+				break;
+			case ACL_MASK:
+				mask_obj_p = entry_obj_p;
+				mask = entry_obj_p->eperm.sperm;
+				break;
+			case ACL_OTHER:
+				other = entry_obj_p->eperm.sperm;
+				break;
+		}
+	}
+	if (!mask_obj_p)
+		return 0;
+
+	/*
+	 * A process that matches a named group entry is granted what one of
+	 * the group class entries it matches grants. The entry is redundant
+	 * if processes that match no other group class entry get the same
+	 * from the other entry, and the other group class entries grant at
+	 * least as much.
+	 */
+	for (entry_obj_p = acl_obj_p->anext;
+	     entry_obj_p != (acl_entry_obj *)acl_obj_p;
+	     entry_obj_p = next_p) {
+		next_p = entry_obj_p->enext;
+		if (entry_obj_p->etag != ACL_GROUP)
+			continue;
+		perm = entry_obj_p->eperm.sperm & mask;
+		if (perm == other &&
+		    group_class_covers(acl_obj_p, entry_obj_p, mask, perm)) {
+			remove_entry_obj(acl_obj_p, entry_obj_p);
+			changed = 1;
+		}
+	}
+
+	/*
+	 * A process that no longer matches a named user entry may match any
+	 * of the group class entries or none, so they all must grant the
+	 * same as the named user entry and the other entry.
+	 */
+	FOREACH_ACL_ENTRY(entry_obj_p, acl_obj_p) {
+		if ((entry_obj_p->etag == ACL_GROUP_OBJ ||
+		     entry_obj_p->etag == ACL_GROUP) &&
+		    (entry_obj_p->eperm.sperm & mask) != other)
+			uniform = 0;
+	}
+	for (entry_obj_p = acl_obj_p->anext;
+	     entry_obj_p != (acl_entry_obj *)acl_obj_p;
+	     entry_obj_p = next_p) {
+		next_p = entry_obj_p->enext;
+		if (entry_obj_p->etag != ACL_USER)
+			continue;
+		if (uniform && (entry_obj_p->eperm.sperm & mask) == other) {
+			remove_entry_obj(acl_obj_p, entry_obj_p);
+			changed = 1;
+		}
+	}
+
+	FOREACH_ACL_ENTRY(entry_obj_p, acl_obj_p) {
+		if (entry_obj_p->etag == ACL_USER ||
+		    entry_obj_p->etag == ACL_GROUP) {
+			named = 1;
+			used |= entry_obj_p->eperm.sperm;
+		} else if (entry_obj_p->etag == ACL_GROUP_OBJ)
+			used |= entry_obj_p->eperm.sperm;
+	}
+	if (!named) {
+		/* Without named entries, the mask is not needed. */
+		group_obj_p->eperm.sperm &= mask;
+		remove_entry_obj(acl_obj_p, mask_obj_p);
+		changed = 1;
+	} else if ((mask & used) != mask && (mask & used) != ACL_PERM_NONE) {
+		/*
+		 * Linux does not check the ACL of a file whose group class
+		 * permissions are empty, so the mask must not become empty.
+		 */
+		mask_obj_p->eperm.sperm = mask & used;
+		changed = 1;
+	}
+	return changed;
+}
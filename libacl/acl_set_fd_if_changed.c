@@ -0,0 +1,93 @@
+/*
+  File: acl_set_fd_if_changed.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <attr/xattr.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+/* ACLs of up to this many entries are compared without allocating */
+#define STACK_ENTRIES	32
+
+/*
+ * Like acl_set_fd(), but only write the ACL if it differs from the ACL
+ * the file already has. Returns 1 if the ACL was written, and 0 if the
+ * file already had it.
+ */
+int
+acl_set_fd_if_changed(int fd, acl_t acl)
+{
+	acl_obj *acl_obj_p = ext2int(acl, acl);
+	char new_buf[acl_ea_size(STACK_ENTRIES)];
+	char old_buf[acl_ea_size(STACK_ENTRIES)];
+	char *ext_acl_p = new_buf, *old_acl_p = old_buf;
+	const char *name = ACL_EA_ACCESS;
+	int changed = 1;
+	ssize_t retval, size;
+	int error;
+
+	if (!acl_obj_p)
+		return -1;
+	size = acl_to_xattr(acl, new_buf, sizeof(new_buf));
+	if (size < 0)
+		return -1;
+	if ((size_t)size > sizeof(new_buf)) {
+		ext_acl_p = malloc(2 * size);
+		if (!ext_acl_p)
+			return -1;
+		old_acl_p = ext_acl_p + size;
+		acl_to_xattr(acl, ext_acl_p, size);
+	}
+
+	retval = fgetxattr(fd, name, old_acl_p, size);
+	if (retval == size)
+		changed = memcmp(old_acl_p, ext_acl_p, size) != 0;
+	else if (retval < 0 && (errno == ENOATTR || errno == ENODATA)) {
+		struct stat st;
+		mode_t mode;
+
+		if (acl_equiv_mode(acl, &mode) == 0) {
+			if (fstat(fd, &st) != 0)
+				goto fail;
+			changed = ((st.st_mode & 0777) != mode);
+		}
+	} else if (retval < 0 && errno != ERANGE)
+		goto fail;
+
+	if (changed && fsetxattr(fd, name, (char *)ext_acl_p, size, 0) != 0)
+		goto fail;
+	goto out;
+
+fail:
+	changed = -1;
+out:
+	if (ext_acl_p != new_buf) {
+		error = errno;
+		free(ext_acl_p);
+		errno = error;
+	}
+	return changed;
+}
+
@@ -0,0 +1,127 @@
+/*
+  File: acl_set_file_if_changed.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <attr/xattr.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+/* ACLs of up to this many entries are compared without allocating */
+#define STACK_ENTRIES	32
+
+/*
+ * Like acl_set_file(), but only write the ACL if it differs from the
+ * ACL the file already has: the current attribute value is compared
+ * with the new one byte by byte. This avoids needless writes to the
+ * file system and keeps the status change time of the file unchanged.
+ * Returns 1 if the ACL was written, and 0 if the file already had it.
+ */
+int
+acl_set_file_if_changed(const char *path_p, acl_type_t type, acl_t acl)
+{
+	acl_obj *acl_obj_p = ext2int(acl, acl);
+	char new_buf[acl_ea_size(STACK_ENTRIES)];
+	char old_buf[acl_ea_size(STACK_ENTRIES)];
+	char *ext_acl_p = new_buf, *old_acl_p = old_buf;
+	const char *name;
+	struct stat st;
+	int have_st = 0, changed = 1;
+	ssize_t retval, size;
+	int error;
+
+	if (!acl_obj_p)
+		return -1;
+	switch (type) {
+		case ACL_TYPE_ACCESS:
+			name = ACL_EA_ACCESS;
+			break;
+		case ACL_TYPE_DEFAULT:
+			name = ACL_EA_DEFAULT;
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+
+	if (type == ACL_TYPE_DEFAULT) {
+		if (stat(path_p, &st) != 0)
+			return -1;
+		have_st = 1;
+
+		/* Only directories may have default ACLs. */
+		if (!S_ISDIR(st.st_mode)) {
+			errno = EACCES;
+			return -1;
+		}
+	}
+
+	size = acl_to_xattr(acl, new_buf, sizeof(new_buf));
+	if (size < 0)
+		return -1;
+	if ((size_t)size > sizeof(new_buf)) {
+		ext_acl_p = malloc(2 * size);
+		if (!ext_acl_p)
+			return -1;
+		old_acl_p = ext_acl_p + size;
+		acl_to_xattr(acl, ext_acl_p, size);
+	}
+
+	/* ERANGE means that the current ACL is bigger. */
+	retval = getxattr(path_p, name, old_acl_p, size);
+	if (retval == size)
+		changed = memcmp(old_acl_p, ext_acl_p, size) != 0;
+	else if (retval < 0 && (errno == ENOATTR || errno == ENODATA)) {
+		mode_t mode;
+
+		/*
+		 * Without an attribute, the access ACL is defined by the
+		 * file mode, and there is no default ACL.
+		 */
+		if (type == ACL_TYPE_DEFAULT)
+			changed = (acl_obj_p->aused != 0);
+		else if (acl_equiv_mode(acl, &mode) == 0) {
+			if (!have_st && stat(path_p, &st) != 0)
+				goto fail;
+			changed = ((st.st_mode & 0777) != mode);
+		}
+	} else if (retval < 0 && errno != ERANGE)
+		goto fail;
+
+	if (changed &&
+	    setxattr(path_p, name, (char *)ext_acl_p, size, 0) != 0)
+		goto fail;
+	goto out;
+
+fail:
+	changed = -1;
+out:
+	if (ext_acl_p != new_buf) {
+		error = errno;
+		free(ext_acl_p);
+		errno = error;
+	}
+	return changed;
+}
+
@@ -0,0 +1,46 @@
+/*
+  File: acl_to_xattr.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+#include "__acl_to_xattr.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+
+/*
+ * Store the extended attribute representation of ACL in BUF_P if it
+ * fits into SIZE bytes. Returns the size of the representation (like
+ * snprintf(), so the result may be bigger than SIZE).
+ */
+ssize_t
+acl_to_xattr(acl_t acl, void *buf_p, size_t size)
+{
+	acl_obj *acl_obj_p = ext2int(acl, acl);
+	size_t ext_size;
+
+	if (!acl_obj_p)
+		return -1;
+	ext_size = acl_ea_size(acl_obj_p->aused);
+	if (ext_size <= size)
+		__acl_to_xattr_buf(acl_obj_p, buf_p);
+	return ext_size;
+}
+
@@ -0,0 +1,106 @@
+/*
+  File: acl_xattr_valid.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+
+#include "byteorder.h"
+#include "acl_ea.h"
+
+
+/*
+ * Check if an extended attribute value is a valid ACL, without decoding
+ * it. The rules are those the kernel applies: the entries are sorted by
+ * tag and then by qualifier, qualifiers are unique, and a mask entry is
+ * required if there are named user or group entries.
+ */
+int
+acl_xattr_valid(const void *buf_p, size_t size)
+{
+	const acl_ea_header *ext_header_p = buf_p;
+	const acl_ea_entry *ext_entry_p, *ext_end_p;
+	int count = acl_ea_count(size);
+	int state = ACL_USER_OBJ, needs_mask = 0, have_id = 0;
+	id_t id = 0;
+
+	if (count < 0 ||
+	    ext_header_p->a_version != cpu_to_le32(ACL_EA_VERSION))
+		goto invalid;
+	if (count == 0)
+		return 0;
+
+	ext_entry_p = (const acl_ea_entry *)(ext_header_p + 1);
+	ext_end_p = ext_entry_p + count;
+	for (; ext_entry_p != ext_end_p; ext_entry_p++) {
+		int tag = le16_to_cpu(ext_entry_p->e_tag);
+
+		if (le16_to_cpu(ext_entry_p->e_perm) &
+		    ~(ACL_READ | ACL_WRITE | ACL_EXECUTE))
+			goto invalid;
+		switch (tag) {
+			case ACL_USER_OBJ:
+				if (state != ACL_USER_OBJ)
+					goto invalid;
+				state = ACL_USER;
+				break;
+
+			case ACL_USER:
+			case ACL_GROUP:
+				if (state != tag)
+					goto invalid;
+				if (have_id &&
+				    le32_to_cpu(ext_entry_p->e_id) <= id)
+					goto invalid;
+				id = le32_to_cpu(ext_entry_p->e_id);
+				have_id = 1;
+				needs_mask = 1;
+				break;
+
+			case ACL_GROUP_OBJ:
+				if (state != ACL_USER)
+					goto invalid;
+				state = ACL_GROUP;
+				have_id = 0;
+				break;
+
+			case ACL_MASK:
+				if (state != ACL_GROUP)
+					goto invalid;
+				state = ACL_OTHER;
+				break;
+
+			case ACL_OTHER:
+				if (state != ACL_OTHER &&
+				    (state != ACL_GROUP || needs_mask))
+					goto invalid;
+				state = 0;
+				break;
+
+			default:
+				goto invalid;
+		}
+	}
+	if (state == 0)
+		return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
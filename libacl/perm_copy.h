@@ -23,6 +23,7 @@
 #define HAVE_LIBACL_LIBACL_H 1
 
 #define HAVE_ACL_DELETE_DEF_FILE 1
+#define HAVE_ACL_COPY_XATTR 1
 #define HAVE_ACL_ENTRIES 1
 #define HAVE_ACL_FREE 1
 #define HAVE_ACL_FROM_MODE 1
@@ -35,3 +36,5 @@
 #define HAVE_ACL_GET_TAG_TYPE 1
 #define HAVE_ACL_SET_FD 1
 #define HAVE_ACL_SET_FILE 1
+#define HAVE_ACL_SET_FD_IF_CHANGED 1
+#define HAVE_ACL_SET_FILE_IF_CHANGED 1
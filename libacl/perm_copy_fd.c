@@ -45,6 +45,10 @@
 #include "error_context.h"
 #endif
 
+#if defined(HAVE_ACL_COPY_XATTR)
+#include "__acl_copy_xattr.h"
+#endif
+
 #if !defined(ENOTSUP)
 # define ENOTSUP (-1)
 #endif
@@ -101,6 +105,12 @@ acl_from_mode(mode_t mode)
 }
 #endif
 
+#if defined(HAVE_ACL_SET_FD_IF_CHANGED)
+/* Leave ACLs that are already correct alone.  */
+# define acl_set_fd(fd, acl) \
+	(acl_set_fd_if_changed (fd, acl) < 0 ? -1 : 0)
+#endif
+
 /* Set the access control list of path to the permissions defined by mode.  */
 static int
 set_acl_fd (char const *path, int fd, mode_t mode, struct error_context *ctx)
@@ -160,6 +170,12 @@ perm_copy_fd (const char *src_path, int src_fd,
 		quote_free (ctx, qpath);
 		return -1;
 	}
+#if defined(HAVE_ACL_COPY_XATTR)
+	/* Copy the ACL attribute as it is if we can.  */
+	if (__acl_copy_xattr (src_path, src_fd, dst_path, dst_fd,
+			      ACL_TYPE_ACCESS, st.st_mode) == 0)
+		return 0;
+#endif
 #if defined(HAVE_ACL_GET_FD) && defined(HAVE_ACL_SET_FD)
 	/* POSIX 1003.1e draft 17 (abandoned) specific version.  */
 	acl = acl_get_fd (src_fd);
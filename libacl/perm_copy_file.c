@@ -45,6 +45,10 @@
 #include "error_context.h"
 #endif
 
+#if defined(HAVE_ACL_COPY_XATTR)
+#include "__acl_copy_xattr.h"
+#endif
+
 #if !defined(ENOTSUP)
 # define ENOTSUP (-1)
 #endif
@@ -101,6 +105,12 @@ acl_from_mode(mode_t mode)
 }
 #endif
 
+#if defined(HAVE_ACL_SET_FILE_IF_CHANGED)
+/* Leave ACLs that are already correct alone.  */
+# define acl_set_file(path, type, acl) \
+	(acl_set_file_if_changed (path, type, acl) < 0 ? -1 : 0)
+#endif
+
 /* Set the access control list of path to the permissions defined by mode.  */
 static int
 set_acl (char const *path, mode_t mode, struct error_context *ctx)
@@ -173,6 +183,15 @@ perm_copy_file (const char *src_path, const char *dst_path,
 		quote_free (ctx, qpath);
 		return -1;
 	}
+#if defined(HAVE_ACL_COPY_XATTR)
+	/* Copy the ACL attributes as they are if we can.  */
+	if (__acl_copy_xattr (src_path, -1, dst_path, -1, ACL_TYPE_ACCESS,
+			      st.st_mode) == 0 &&
+	    (!S_ISDIR (st.st_mode) ||
+	     __acl_copy_xattr (src_path, -1, dst_path, -1, ACL_TYPE_DEFAULT,
+			       st.st_mode) == 0))
+		return 0;
+#endif
 #if defined(HAVE_ACL_GET_FILE) && defined(HAVE_ACL_SET_FILE)
 	/* POSIX 1003.1e draft 17 (abandoned) specific version.  */
 	acl = acl_get_file (src_path, ACL_TYPE_ACCESS);
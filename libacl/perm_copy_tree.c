@@ -0,0 +1,356 @@
+/*
+  File: perm_copy_tree.c
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <acl/libacl.h>
+#include "libacl.h"
+#include "walk_tree.h"
+
+#define ERROR_CONTEXT_MACROS
+#ifdef HAVE_ATTR_ERROR_CONTEXT_H
+#include <attr/error_context.h>
+#else
+#include "error_context.h"
+#endif
+
+/* Number of paths queued for the worker threads */
+#define QUEUE_SIZE	256
+
+struct tree_copy;
+
+/*
+ * With worker threads, errors are reported through the caller's error
+ * context one at a time: a thread holds the lock from quote() to
+ * quote_free(), or for a single error() otherwise.
+ */
+struct tree_context {
+	struct error_context ctx;
+	struct tree_copy *tc;
+	int locked;
+};
+
+struct tree_copy {
+	const char *src_path;
+	const char *dst_path;
+	size_t src_len;
+	struct error_context *ctx;
+	struct error_context *walk_ctx;
+	int errors;
+
+	/* Directories are copied last, the deepest ones first. */
+	struct tree_dir {
+		char *path;
+		int depth;
+	} *dirs;
+	size_t num_dirs, max_dirs;
+
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full, idle;
+	char *queue[QUEUE_SIZE];
+	unsigned int head, count, busy;
+	int threads, done;
+};
+
+static void
+tree_error(struct error_context *ctx, const char *fmt, ...)
+{
+	struct tree_context *tctx = (struct tree_context *)ctx;
+	struct error_context *user_ctx = tctx->tc->ctx;
+	int saved_errno = errno;
+	char *msg = NULL;
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (vasprintf(&msg, fmt, ap) < 0)
+		msg = NULL;
+	va_end(ap);
+	if (!tctx->locked)
+		pthread_mutex_lock(&tctx->tc->lock);
+	errno = saved_errno;
+	/* An empty message stands for the error in errno. */
+	if (msg && *msg)
+		error(user_ctx, "%s", msg);
+	else
+		error(user_ctx, "");
+	if (!tctx->locked)
+		pthread_mutex_unlock(&tctx->tc->lock);
+	free(msg);
+}
+
+static const char *
+tree_quote(struct error_context *ctx, const char *name)
+{
+	struct tree_context *tctx = (struct tree_context *)ctx;
+
+	pthread_mutex_lock(&tctx->tc->lock);
+	tctx->locked = 1;
+	return quote(tctx->tc->ctx, name);
+}
+
+static void
+tree_quote_free(struct error_context *ctx, const char *name)
+{
+	struct tree_context *tctx = (struct tree_context *)ctx;
+
+	quote_free(tctx->tc->ctx, name);
+	tctx->locked = 0;
+	pthread_mutex_unlock(&tctx->tc->lock);
+}
+
+static int
+copy_one(struct tree_copy *tc, const char *path, struct error_context *ctx)
+{
+	const char *rel = path + tc->src_len;
+	size_t dst_len = strlen(tc->dst_path);
+	char *dst_path;
+	int ret;
+
+	dst_path = malloc(dst_len + strlen(rel) + 1);
+	if (!dst_path) {
+		error(ctx, "");
+		return -1;
+	}
+	memcpy(dst_path, tc->dst_path, dst_len);
+	strcpy(dst_path + dst_len, rel);
+	ret = perm_copy_file(path, dst_path, ctx);
+	free(dst_path);
+	return ret;
+}
+
+static void
+tree_context_init(struct tree_context *tctx, struct tree_copy *tc)
+{
+	tctx->ctx.error = tree_error;
+	tctx->ctx.quote = tree_quote;
+	tctx->ctx.quote_free = tree_quote_free;
+	tctx->tc = tc;
+	tctx->locked = 0;
+}
+
+static void *
+tree_worker(void *arg)
+{
+	struct tree_copy *tc = arg;
+	struct tree_context tctx;
+
+	tree_context_init(&tctx, tc);
+
+	pthread_mutex_lock(&tc->lock);
+	for(;;) {
+		char *path;
+		int ret;
+
+		while (tc->count == 0 && !tc->done)
+			pthread_cond_wait(&tc->not_empty, &tc->lock);
+		if (tc->count == 0)
+			break;
+		path = tc->queue[tc->head];
+		tc->head = (tc->head + 1) % QUEUE_SIZE;
+		tc->count--;
+		tc->busy++;
+		pthread_cond_signal(&tc->not_full);
+		pthread_mutex_unlock(&tc->lock);
+
+		ret = copy_one(tc, path, tc->ctx ? &tctx.ctx : NULL);
+		free(path);
+
+		pthread_mutex_lock(&tc->lock);
+		if (ret != 0)
+			tc->errors++;
+		tc->busy--;
+		if (tc->count == 0 && tc->busy == 0)
+			pthread_cond_broadcast(&tc->idle);
+	}
+	pthread_mutex_unlock(&tc->lock);
+	return NULL;
+}
+
+/* Copy the permissions of path, or hand it to a worker thread. */
+static int
+tree_push(struct tree_copy *tc, const char *path)
+{
+	char *copy;
+
+	if (tc->threads == 0)
+		return copy_one(tc, path, tc->ctx);
+
+	copy = strdup(path);
+	if (!copy) {
+		error(tc->walk_ctx, "");
+		return -1;
+	}
+	pthread_mutex_lock(&tc->lock);
+	while (tc->count == QUEUE_SIZE)
+		pthread_cond_wait(&tc->not_full, &tc->lock);
+	tc->queue[(tc->head + tc->count) % QUEUE_SIZE] = copy;
+	tc->count++;
+	pthread_cond_signal(&tc->not_empty);
+	pthread_mutex_unlock(&tc->lock);
+	return 0;
+}
+
+/* Wait until the worker threads have processed all queued paths. */
+static void
+tree_drain(struct tree_copy *tc)
+{
+	if (tc->threads == 0)
+		return;
+	pthread_mutex_lock(&tc->lock);
+	while (tc->count != 0 || tc->busy != 0)
+		pthread_cond_wait(&tc->idle, &tc->lock);
+	pthread_mutex_unlock(&tc->lock);
+}
+
+static int
+tree_dir_cmp(const void *a, const void *b)
+{
+	const struct tree_dir *da = a, *db = b;
+
+	return db->depth - da->depth;
+}
+
+static int
+tree_visit(const char *path, const struct stat *st, int walk_flags,
+	   void *arg)
+{
+	struct tree_copy *tc = arg;
+	struct tree_dir *dir;
+	const char *p;
+
+	if (walk_flags & WALK_TREE_FAILED) {
+		const char *qpath = quote(tc->walk_ctx, path);
+		error(tc->walk_ctx, "%s", qpath);
+		quote_free(tc->walk_ctx, qpath);
+		return 1;
+	}
+	/* The permissions of symlinks themselves cannot be changed. */
+	if (S_ISLNK(st->st_mode))
+		return 0;
+	if (!S_ISDIR(st->st_mode))
+		return tree_push(tc, path) != 0;
+
+	/*
+	 * Changing the permissions of a directory may make its contents
+	 * inaccessible: remember the directory for later.
+	 */
+	if (tc->num_dirs == tc->max_dirs) {
+		size_t max_dirs = tc->max_dirs ? 2 * tc->max_dirs : 64;
+
+		dir = realloc(tc->dirs, max_dirs * sizeof(*dir));
+		if (!dir)
+			goto fail;
+		tc->dirs = dir;
+		tc->max_dirs = max_dirs;
+	}
+	dir = &tc->dirs[tc->num_dirs];
+	dir->path = strdup(path);
+	if (!dir->path)
+		goto fail;
+	dir->depth = 0;
+	for (p = path + tc->src_len; *p; p++)
+		if (*p == '/')
+			dir->depth++;
+	tc->num_dirs++;
+	return 0;
+
+fail:
+	error(tc->walk_ctx, "");
+	return 1;
+}
+
+/*
+ * Copy the permissions of all files below src_path to the files with the
+ * same names below dst_path, using up to jobs threads. Both trees must
+ * exist; directories are updated after the files they contain. Threads
+ * may copy trees concurrently, but a copy cannot be started from the
+ * error context of a copy in progress in the same thread (EBUSY).
+ */
+int
+perm_copy_tree(const char *src_path, const char *dst_path, int flags,
+	       int jobs, struct error_context *ctx)
+{
+	struct tree_copy tc = {
+		.src_path = src_path,
+		.dst_path = dst_path,
+		.src_len = strlen(src_path),
+		.ctx = ctx,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.not_empty = PTHREAD_COND_INITIALIZER,
+		.not_full = PTHREAD_COND_INITIALIZER,
+		.idle = PTHREAD_COND_INITIALIZER,
+	};
+	int walk_flags = WALK_TREE_RECURSIVE | WALK_TREE_POSTORDER;
+	struct tree_context walk_tctx;
+	pthread_t *threads = NULL;
+	size_t n;
+	int errors;
+
+	if (flags & ~(PERM_COPY_TREE_LOGICAL | PERM_COPY_TREE_ONE_FILESYSTEM)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (flags & PERM_COPY_TREE_LOGICAL)
+		walk_flags |= WALK_TREE_LOGICAL | WALK_TREE_DEREFERENCE;
+	else
+		walk_flags |= WALK_TREE_PHYSICAL;
+	if (flags & PERM_COPY_TREE_ONE_FILESYSTEM)
+		walk_flags |= WALK_TREE_ONE_FILESYSTEM;
+
+	if (jobs > 1)
+		threads = malloc(jobs * sizeof(*threads));
+	if (threads) {
+		while (tc.threads < jobs &&
+		       pthread_create(&threads[tc.threads], NULL,
+				      tree_worker, &tc) == 0)
+			tc.threads++;
+	}
+	tc.walk_ctx = ctx;
+	if (tc.threads && ctx) {
+		tree_context_init(&walk_tctx, &tc);
+		tc.walk_ctx = &walk_tctx.ctx;
+	}
+
+	errors = walk_tree(src_path, walk_flags, 0, tree_visit, &tc);
+	tree_drain(&tc);
+
+	qsort(tc.dirs, tc.num_dirs, sizeof(*tc.dirs), tree_dir_cmp);
+	for (n = 0; n < tc.num_dirs; n++) {
+		if (n && tc.dirs[n].depth != tc.dirs[n - 1].depth)
+			tree_drain(&tc);
+		if (tree_push(&tc, tc.dirs[n].path) != 0)
+			errors++;
+		free(tc.dirs[n].path);
+	}
+	free(tc.dirs);
+
+	pthread_mutex_lock(&tc.lock);
+	tc.done = 1;
+	pthread_cond_broadcast(&tc.not_empty);
+	pthread_mutex_unlock(&tc.lock);
+	while (tc.threads)
+		pthread_join(threads[--tc.threads], NULL);
+	free(threads);
+
+	return (errors || tc.errors) ? -1 : 0;
+}
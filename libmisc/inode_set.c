@@ -0,0 +1,168 @@
+/*
+  File: inode_set.c
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License as published by the
+  Free Software Foundation; either version 2.1 of the License, or (at
+  your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "inode_set.h"
+
+/*
+ * An open addressing hash table with linear probing. The table grows up
+ * to twice the maximum number of entries, so probe sequences stay short.
+ */
+
+struct inode_entry {
+	dev_t dev;
+	ino_t ino;
+	char *path;	/* first path seen, if requested */
+	int used;
+};
+
+struct inode_set {
+	struct inode_entry *table;
+	size_t size;	/* always a power of two */
+	size_t used;
+	size_t max_entries;
+};
+
+#define INODE_SET_INITIAL_SIZE	256
+
+static size_t inode_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = ((uint64_t)ino ^ ((uint64_t)dev << 32) ^ (uint64_t)dev);
+
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+
+struct inode_set *inode_set_create(size_t max_entries)
+{
+	struct inode_set *set;
+
+	set = calloc(1, sizeof(*set));
+	if (!set)
+		return NULL;
+	set->size = INODE_SET_INITIAL_SIZE;
+	set->table = calloc(set->size, sizeof(*set->table));
+	if (!set->table) {
+		free(set);
+		return NULL;
+	}
+	set->max_entries = max_entries ? max_entries : INODE_SET_MAX;
+	return set;
+}
+
+void inode_set_free(struct inode_set *set)
+{
+	size_t n;
+
+	if (!set)
+		return;
+	for (n = 0; n < set->size; n++)
+		free(set->table[n].path);
+	free(set->table);
+	free(set);
+}
+
+static struct inode_entry *inode_set_lookup(struct inode_set *set, dev_t dev,
+					    ino_t ino)
+{
+	size_t mask = set->size - 1, n;
+
+	for (n = inode_hash(dev, ino) & mask;
+	     set->table[n].used;
+	     n = (n + 1) & mask) {
+		if (set->table[n].dev == dev && set->table[n].ino == ino)
+			break;
+	}
+	return &set->table[n];
+}
+
+static int inode_set_grow(struct inode_set *set)
+{
+	struct inode_entry *old_table = set->table;
+	size_t old_size = set->size, n;
+
+	set->table = calloc(2 * old_size, sizeof(*set->table));
+	if (!set->table) {
+		set->table = old_table;
+		return -1;
+	}
+	set->size = 2 * old_size;
+	for (n = 0; n < old_size; n++) {
+		if (old_table[n].used)
+			*inode_set_lookup(set, old_table[n].dev,
+					  old_table[n].ino) = old_table[n];
+	}
+	free(old_table);
+	return 0;
+}
+
+/*
+ * Check if an inode is in the set. If so, PATH is set to the path
+ * remembered along with it (which may be NULL).
+ */
+int inode_set_find(struct inode_set *set, dev_t dev, ino_t ino,
+		   const char **path)
+{
+	struct inode_entry *entry;
+
+	entry = inode_set_lookup(set, dev, ino);
+	if (!entry->used)
+		return 0;
+	if (path)
+		*path = entry->path;
+	return 1;
+}
+
+/*
+ * Add an inode to the set if it is not there, yet. If PATH is given, it
+ * is remembered along with the inode.
+ *
+ * Returns 1 if the inode was in the set, 0 if it was added, and -1 if it
+ * could not be added because the set is full or out of memory.
+ */
+int inode_set_add(struct inode_set *set, dev_t dev, ino_t ino,
+		  const char *path)
+{
+	struct inode_entry *entry;
+
+	entry = inode_set_lookup(set, dev, ino);
+	if (entry->used)
+		return 1;
+	if (set->used >= set->max_entries) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if (2 * (set->used + 1) > set->size) {
+		if (inode_set_grow(set) != 0)
+			return -1;
+		entry = inode_set_lookup(set, dev, ino);
+	}
+	entry->path = NULL;
+	if (path) {
+		entry->path = strdup(path);
+		if (!entry->path)
+			return -1;
+	}
+	entry->dev = dev;
+	entry->ino = ino;
+	entry->used = 1;
+	set->used++;
+	return 0;
+}
@@ -55,3 +55,20 @@ char *next_line(FILE *file)
 	} while (!eol);
 	return line;
 }
+
+/*
+ * Return the next file name in FILE. Names are separated by newlines, or
+ * by null characters if NULL_SEPARATED is set, so that any name can be
+ * passed. Returns NULL at the end of FILE or after an error.
+ */
+char *next_name(FILE *file, int null_separated)
+{
+	static char *name;
+	static size_t name_size;
+
+	if (!null_separated)
+		return next_line(file);
+	if (getdelim(&name, &name_size, '\0', file) == -1)
+		return NULL;
+	return name;
+}
@@ -0,0 +1,441 @@
+/*
+  File: serve.c
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License as published by the
+  Free Software Foundation; either version 2.1 of the License, or (at
+  your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include "misc.h"
+#include "serve.h"
+
+/* Largest number of connections served at the same time */
+#define SERVE_MAX_CONN	64
+
+/* Size by which connection buffers grow at first */
+#define SERVE_BUF_SIZE	4096
+
+/* Longest request; connections sending longer ones are closed */
+#define SERVE_MAX_REQUEST	(1 << 20)
+
+/*
+ * Responses are queued and sent as the client reads them. No further
+ * requests of a connection are served while this much is queued.
+ */
+#define SERVE_MAX_QUEUED	(1 << 20)
+
+struct serve_buf {
+	char *buf;
+	size_t size, len;
+};
+
+struct serve_conn {
+	int fd;
+	struct serve_buf in, out;
+	size_t out_pos;		/* sent so far */
+	int eof;		/* no more requests */
+};
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig)
+{
+	serve_stop = 1;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Split a request into its fields, and unescape them in place. */
+static int split_request(char *line, char ***argv_p)
+{
+	static char **argv;
+	static size_t argv_size;
+	char *p = line;
+	int argc = 0;
+
+	for(;;) {
+		while (*p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+		if (high_water_alloc((void **)&argv, &argv_size,
+				     (argc + 1) * sizeof(*argv)))
+			return -1;
+		if (*p == '\0')
+			break;
+		argv[argc++] = p;
+		while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r')
+			p++;
+		if (*p != '\0')
+			*p++ = '\0';
+		unquote(argv[argc - 1]);
+	}
+	argv[argc] = NULL;
+	*argv_p = argv;
+	return argc;
+}
+
+static int buf_append(struct serve_buf *b, const char *data, size_t len)
+{
+	if (b->len + len > b->size) {
+		size_t size = b->size ? b->size : SERVE_BUF_SIZE;
+		char *buf;
+
+		while (size < b->len + len)
+			size *= 2;
+		buf = realloc(b->buf, size);
+		if (!buf)
+			return -1;
+		b->buf = buf;
+		b->size = size;
+	}
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+/*
+ * Run the handler for one request with its stdout and stderr redirected
+ * into memory, and append the response to resp. The redirection applies
+ * to the whole process, so no other request can run in the meantime.
+ */
+static int serve_request(char *line, serve_handler_t handler, void *arg,
+			 struct serve_buf *resp)
+{
+	FILE *saved_stdout = stdout, *saved_stderr = stderr;
+	FILE *out_file = NULL, *err_file = NULL;
+	char *out = NULL, *err = NULL;
+	size_t out_size = 0, err_size = 0;
+	char header[64];
+	char **argv;
+	int argc, status, ret = -1;
+
+	argc = split_request(line, &argv);
+	if (argc < 0)
+		return -1;
+	out_file = open_memstream(&out, &out_size);
+	err_file = open_memstream(&err, &err_size);
+	if (!out_file || !err_file)
+		goto out;
+
+	stdout = out_file;
+	stderr = err_file;
+	status = handler(argc, argv, arg);
+	stdout = saved_stdout;
+	stderr = saved_stderr;
+
+	/* The buffers and sizes are only final after fclose(). */
+	fclose(out_file);
+	fclose(err_file);
+	out_file = err_file = NULL;
+	snprintf(header, sizeof(header), "%d %zu %zu\n",
+		 status, out_size, err_size);
+	if (buf_append(resp, header, strlen(header)) == 0 &&
+	    buf_append(resp, out, out_size) == 0 &&
+	    buf_append(resp, err, err_size) == 0)
+		ret = 0;
+
+out:
+	if (out_file)
+		fclose(out_file);
+	if (err_file)
+		fclose(err_file);
+	free(out);
+	free(err);
+	return ret;
+}
+
+/*
+ * Serve the complete requests received on a connection, until too much
+ * of the responses is queued.
+ */
+static int serve_conn_requests(struct serve_conn *conn,
+			       serve_handler_t handler, void *arg)
+{
+	char *line = conn->in.buf, *end;
+	size_t len = conn->in.len;
+
+	if (!len)
+		return 0;
+	while (conn->out.len - conn->out_pos < SERVE_MAX_QUEUED &&
+	       (end = memchr(line, '\n', len))) {
+		*end = '\0';
+		if (serve_request(line, handler, arg, &conn->out) != 0)
+			return -1;
+		len -= end + 1 - line;
+		line = end + 1;
+	}
+	memmove(conn->in.buf, line, len);
+	conn->in.len = len;
+	return 0;
+}
+
+/*
+ * Read from a connection and serve the complete requests received. Returns
+ * -1 when the connection should be closed.
+ */
+static int serve_conn_read(struct serve_conn *conn, serve_handler_t handler,
+			   void *arg)
+{
+	ssize_t ret;
+
+	if (conn->in.len == conn->in.size) {
+		size_t size = conn->in.size ? 2 * conn->in.size :
+					      SERVE_BUF_SIZE;
+		char *buf;
+
+		/* Requests may be held back until responses are sent. */
+		if (conn->in.len && memchr(conn->in.buf, '\n', conn->in.len))
+			return 0;
+		if (conn->in.size >= SERVE_MAX_REQUEST)
+			return -1;  /* request too long */
+		buf = realloc(conn->in.buf, size);
+		if (!buf)
+			return -1;
+		conn->in.buf = buf;
+		conn->in.size = size;
+	}
+	ret = read(conn->fd, conn->in.buf + conn->in.len,
+		   conn->in.size - conn->in.len);
+	if (ret < 0)
+		return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+	if (ret == 0) {
+		/* Answer the requests received before closing. */
+		conn->eof = 1;
+		return 0;
+	}
+	conn->in.len += ret;
+	return serve_conn_requests(conn, handler, arg);
+}
+
+/*
+ * Send as much of the queued responses as the connection takes without
+ * blocking, and serve the requests held back for them.
+ */
+static int serve_conn_write(struct serve_conn *conn, serve_handler_t handler,
+			    void *arg)
+{
+	ssize_t ret;
+
+	while (conn->out_pos < conn->out.len) {
+		ret = write(conn->fd, conn->out.buf + conn->out_pos,
+			    conn->out.len - conn->out_pos);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN ? 0 : -1;
+		}
+		conn->out_pos += ret;
+	}
+	conn->out.len = conn->out_pos = 0;
+	return serve_conn_requests(conn, handler, arg);
+}
+
+/* Is the connection served completely? */
+static int serve_conn_done(struct serve_conn *conn)
+{
+	return conn->eof && conn->out.len == 0 &&
+	       !(conn->in.len && memchr(conn->in.buf, '\n', conn->in.len));
+}
+
+/*
+ * Handle the events polled for a connection. Returns -1 when the connection
+ * should be closed.
+ */
+static int serve_conn_event(struct serve_conn *conn, short revents,
+			    serve_handler_t handler, void *arg)
+{
+	if (revents & POLLERR)
+		return -1;
+	if ((revents & (POLLIN | POLLHUP)) &&
+	    serve_conn_read(conn, handler, arg) != 0)
+		return -1;
+	if (serve_conn_write(conn, handler, arg) != 0)
+		return -1;
+	return serve_conn_done(conn) ? -1 : 0;
+}
+
+static void serve_conn_close(struct serve_conn *conn)
+{
+	close(conn->fd);
+	free(conn->in.buf);
+	free(conn->out.buf);
+}
+
+/*
+ * Only accept connections from the owner of the server, or from root. The
+ * socket is only accessible to its owner, but the directory it is created
+ * in may have been made accessible to others.
+ */
+static int serve_peer_allowed(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		return 0;
+	return cred.uid == 0 || cred.uid == geteuid();
+}
+
+static int serve_socket(const char *socket_path, serve_handler_t handler,
+			void *arg)
+{
+	struct serve_conn conns[SERVE_MAX_CONN];
+	struct pollfd fds[SERVE_MAX_CONN + 1];
+	struct sockaddr_un addr;
+	struct sigaction sa, old_int, old_term, old_pipe;
+	int listen_fd, fd, num_conns = 0, n, ret = -1;
+	mode_t old_umask;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		return -1;
+	/* Whoever can connect can change ACLs with our privileges. */
+	old_umask = umask(077);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		umask(old_umask);
+		close(listen_fd);
+		return -1;
+	}
+	umask(old_umask);
+	if (listen(listen_fd, SOMAXCONN) != 0)
+		goto out;
+
+	/* Stop serving on SIGINT and SIGTERM; interrupt poll() for that. */
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = serve_signal;
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, &old_pipe);
+
+	serve_stop = 0;
+	while (!serve_stop) {
+		fds[0].fd = listen_fd;
+		fds[0].events = num_conns < SERVE_MAX_CONN ? POLLIN : 0;
+		for (n = 0; n < num_conns; n++) {
+			struct serve_conn *conn = &conns[n];
+
+			fds[n + 1].fd = conn->fd;
+			fds[n + 1].events = 0;
+			if (!conn->eof &&
+			    conn->out.len - conn->out_pos < SERVE_MAX_QUEUED)
+				fds[n + 1].events |= POLLIN;
+			if (conn->out_pos < conn->out.len)
+				fds[n + 1].events |= POLLOUT;
+		}
+		if (poll(fds, num_conns + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* The last connection takes the place of a closed one. */
+		for (n = num_conns; n-- > 0; ) {
+			if (!fds[n + 1].revents)
+				continue;
+			if (serve_conn_event(&conns[n], fds[n + 1].revents,
+					     handler, arg) != 0) {
+				serve_conn_close(&conns[n]);
+				conns[n] = conns[--num_conns];
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			fd = accept4(listen_fd, NULL, NULL,
+				     SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (fd >= 0 && !serve_peer_allowed(fd)) {
+				close(fd);
+				fd = -1;
+			}
+			if (fd >= 0) {
+				memset(&conns[num_conns], 0,
+				       sizeof(conns[num_conns]));
+				conns[num_conns].fd = fd;
+				num_conns++;
+			}
+		}
+	}
+	if (serve_stop)
+		ret = 0;
+
+	while (num_conns)
+		serve_conn_close(&conns[--num_conns]);
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+	sigaction(SIGPIPE, &old_pipe, NULL);
+
+out:
+	n = errno;
+	close(listen_fd);
+	unlink(socket_path);
+	errno = n;
+	return ret;
+}
+
+/*
+ * Serve requests until the end of standard input, or from socket_path
+ * until SIGINT or SIGTERM. The socket is removed afterwards.
+ */
+int serve(const char *socket_path, serve_handler_t handler, void *arg)
+{
+	struct serve_buf resp = { NULL, 0, 0 };
+	char *line;
+
+	if (socket_path)
+		return serve_socket(socket_path, handler, arg);
+
+	fflush(stdout);
+	while ((line = next_line(stdin))) {
+		resp.len = 0;
+		if (serve_request(line, handler, arg, &resp) != 0 ||
+		    write_all(STDOUT_FILENO, resp.buf, resp.len) != 0) {
+			free(resp.buf);
+			return -1;
+		}
+	}
+	free(resp.buf);
+	return feof(stdin) ? 0 : -1;
+}
@@ -0,0 +1,461 @@
+/*
+  File: uring.c
+
+  This program is free software; you can redistribute it and/or modify it under
+  the terms of the GNU Lesser General Public License as published by the
+  Free Software Foundation; either version 2.1 of the License, or (at
+  your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "config.h"
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_OP_STATX
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	int ops;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int sq_entries;
+	unsigned int sqe_tail;  /* next free sqe (not yet visible to kernel) */
+	unsigned int sqe_submitted;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+			      unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+				 unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_probe(struct uring *ring)
+{
+	size_t size = sizeof(struct io_uring_probe) +
+		      256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+
+	if (!probe)
+		return;
+	if (sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE,
+				  probe, 256) == 0) {
+#define SUPPORTED(op) \
+	((op) <= probe->last_op && \
+	 (probe->ops[(op)].flags & IO_URING_OP_SUPPORTED))
+
+		if (SUPPORTED(IORING_OP_STATX))
+			ring->ops |= URING_STATX;
+#if HAVE_DECL_IORING_OP_GETXATTR
+		if (SUPPORTED(IORING_OP_GETXATTR) &&
+		    SUPPORTED(IORING_OP_FGETXATTR))
+			ring->ops |= URING_GETXATTR;
+		if (SUPPORTED(IORING_OP_SETXATTR))
+			ring->ops |= URING_SETXATTR;
+#endif
+#undef SUPPORTED
+	}
+	free(probe);
+}
+
+struct uring *uring_init(unsigned int entries)
+{
+	struct io_uring_params p;
+	struct uring *ring;
+	void *ptr;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	ring->fd = sys_io_uring_setup(entries, &p);
+	if (ring->fd < 0)
+		goto fail;
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes +
+			     p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ptr = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto fail_close;
+	ring->sq_ring = ptr;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ptr;
+	} else {
+		ptr = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring->fd,
+			   IORING_OFF_CQ_RING);
+		if (ptr == MAP_FAILED)
+			goto fail_unmap;
+		ring->cq_ring = ptr;
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		goto fail_unmap;
+	ring->sqes = ptr;
+
+	ring->sq_head = ring->sq_ring + p.sq_off.head;
+	ring->sq_tail = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ring + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+	ring->sq_entries = p.sq_entries;
+	ring->sqe_tail = ring->sqe_submitted = *ring->sq_tail;
+
+	ring->cq_head = ring->cq_ring + p.cq_off.head;
+	ring->cq_tail = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ring + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ring + p.cq_off.cqes;
+
+	uring_probe(ring);
+	if (!(ring->ops & URING_STATX)) {
+		errno = ENOSYS;
+		uring_exit(ring);
+		return NULL;
+	}
+	return ring;
+
+fail_unmap:
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+fail_close:
+	close(ring->fd);
+fail:
+	free(ring);
+	return NULL;
+}
+
+void uring_exit(struct uring *ring)
+{
+	if (!ring)
+		return;
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	free(ring);
+}
+
+int uring_supports(struct uring *ring, int ops)
+{
+	return (ring->ops & ops) == ops;
+}
+
+unsigned int uring_space(struct uring *ring)
+{
+	unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	return ring->sq_entries - (ring->sqe_tail - head);
+}
+
+/*
+ * The number of queued requests the kernel has not consumed, for example
+ * because uring_submit() failed. These requests will never complete.
+ */
+unsigned int uring_unsubmitted(struct uring *ring)
+{
+	return ring->sqe_tail - __atomic_load_n(ring->sq_head,
+						__ATOMIC_ACQUIRE);
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	if (uring_space(ring) == 0) {
+		errno = EBUSY;
+		return NULL;
+	}
+	sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sqe_tail++;
+	return sqe;
+}
+
+int uring_statx(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned int mask, void *statxbuf, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = dirfd;
+	sqe->addr = (unsigned long) path;
+	sqe->len = mask;
+	sqe->off = (unsigned long) statxbuf;
+	sqe->statx_flags = flags;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+#if HAVE_DECL_IORING_OP_GETXATTR
+int uring_getxattr(struct uring *ring, const char *path, const char *name,
+		   void *value, size_t size, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(ring->ops & URING_GETXATTR)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	sqe = uring_get_sqe(ring);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_GETXATTR;
+	sqe->addr = (unsigned long) name;
+	sqe->len = size;
+	sqe->off = (unsigned long) value;
+	sqe->addr3 = (unsigned long) path;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+int uring_fgetxattr(struct uring *ring, int fd, const char *name,
+		    void *value, size_t size, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(ring->ops & URING_GETXATTR)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	sqe = uring_get_sqe(ring);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_FGETXATTR;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) name;
+	sqe->len = size;
+	sqe->off = (unsigned long) value;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+int uring_setxattr(struct uring *ring, const char *path, const char *name,
+		   const void *value, size_t size, int flags,
+		   uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(ring->ops & URING_SETXATTR)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	sqe = uring_get_sqe(ring);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_SETXATTR;
+	sqe->addr = (unsigned long) name;
+	sqe->len = size;
+	sqe->off = (unsigned long) value;
+	sqe->addr3 = (unsigned long) path;
+	sqe->xattr_flags = flags;
+	sqe->user_data = user_data;
+	return 0;
+}
+#else
+int uring_getxattr(struct uring *ring, const char *path, const char *name,
+		   void *value, size_t size, uint64_t user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_fgetxattr(struct uring *ring, int fd, const char *name,
+		    void *value, size_t size, uint64_t user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_setxattr(struct uring *ring, const char *path, const char *name,
+		   const void *value, size_t size, int flags,
+		   uint64_t user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+/*
+ * Make all prepared submissions visible to the kernel and submit them.
+ * Returns 0 when all of them have been consumed, or -1 on error.
+ */
+int uring_submit(struct uring *ring)
+{
+	unsigned int tail = *ring->sq_tail, to_submit;
+	int ret;
+
+	while (ring->sqe_submitted != ring->sqe_tail) {
+		ring->sq_array[tail & *ring->sq_mask] =
+			ring->sqe_submitted & *ring->sq_mask;
+		tail++;
+		ring->sqe_submitted++;
+	}
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	/*
+	 * The kernel stops consuming submissions at the first one it cannot
+	 * prepare (which completes with an error), so keep going until all
+	 * submissions are consumed.
+	 */
+	for(;;) {
+		to_submit = tail - __atomic_load_n(ring->sq_head,
+						   __ATOMIC_ACQUIRE);
+		if (to_submit == 0)
+			return 0;
+		do
+			ret = sys_io_uring_enter(ring->fd, to_submit, 0, 0);
+		while (ret < 0 && errno == EINTR);
+		if (ret < 0)
+			return -1;
+		if (ret == 0) {
+			errno = EBUSY;
+			return -1;
+		}
+	}
+}
+
+/*
+ * Wait for the next completion, and return its user data and result (a
+ * negative errno value on failure). Returns -1 on error.
+ */
+int uring_wait(struct uring *ring, uint64_t *user_data, int *res)
+{
+	for(;;) {
+		unsigned int head = *ring->cq_head;
+		unsigned int tail = __atomic_load_n(ring->cq_tail,
+						    __ATOMIC_ACQUIRE);
+
+		if (head != tail) {
+			struct io_uring_cqe *cqe =
+				&ring->cqes[head & *ring->cq_mask];
+
+			*user_data = cqe->user_data;
+			*res = cqe->res;
+			__atomic_store_n(ring->cq_head, head + 1,
+					 __ATOMIC_RELEASE);
+			return 0;
+		}
+		if (sys_io_uring_enter(ring->fd, 0, 1,
+				       IORING_ENTER_GETEVENTS) < 0 &&
+		    errno != EINTR)
+			return -1;
+	}
+}
+
+#else  /* !HAVE_LINUX_IO_URING_H */
+
+struct uring *uring_init(unsigned int entries)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void uring_exit(struct uring *ring)
+{
+}
+
+int uring_supports(struct uring *ring, int ops)
+{
+	return 0;
+}
+
+unsigned int uring_space(struct uring *ring)
+{
+	return 0;
+}
+
+unsigned int uring_unsubmitted(struct uring *ring)
+{
+	return 0;
+}
+
+int uring_statx(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned int mask, void *statxbuf, uint64_t user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_getxattr(struct uring *ring, const char *path, const char *name,
+		   void *value, size_t size, uint64_t user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_fgetxattr(struct uring *ring, int fd, const char *name,
+		    void *value, size_t size, uint64_t user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_setxattr(struct uring *ring, const char *path, const char *name,
+		   const void *value, size_t size, int flags,
+		   uint64_t user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_submit(struct uring *ring)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_wait(struct uring *ring, uint64_t *user_data, int *res)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif  /* HAVE_LINUX_IO_URING_H */
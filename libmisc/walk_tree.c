@@ -19,15 +19,23 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fnmatch.h>
+#include <limits.h>
 #include <errno.h>
 
+#include "config.h"
 #include "walk_tree.h"
+#include "uring.h"
+#include "misc.h"
 
 struct entry_handle {
 	struct entry_handle *prev, *next;
@@ -37,13 +45,105 @@ struct entry_handle {
 	off_t pos;
 };
 
-struct entry_handle head = {
-	.next = &head,
-	.prev = &head,
-	/* The other fields are unused. */
+/*
+ * The state of a walk is kept per thread, so that threads can walk trees
+ * concurrently. A thread cannot start a walk from within the callback of
+ * another walk, though. The options set with the walk_tree_set_*(),
+ * walk_tree_exclude*() and walk_tree_prefetch_xattr() functions are shared
+ * by all threads, and must not be changed while any walk is in progress.
+ */
+static __thread struct entry_handle head;  /* initialized in walk_tree() */
+static __thread struct entry_handle *closed;
+static __thread unsigned int num_dir_handles;
+static __thread int walking;
+
+/* Extended attributes to fetch together with the stat information */
+#define WALK_TREE_MAX_XATTRS	2
+#define WALK_TREE_XATTR_SIZE	256
+
+static struct {
+	const char *name;
+	int dirs_only;
+} prefetch_xattrs[WALK_TREE_MAX_XATTRS];
+static unsigned int num_prefetch_xattrs;
+
+/*
+ * With WALK_TREE_INODE_ORDER or WALK_TREE_NAME_ORDER, directory entries
+ * are read in batches, and each batch is sorted before the entries are
+ * visited. Visiting entries in inode number order keeps the inode table
+ * reads of rotational disks mostly sequential.
+ *
+ * With WALK_TREE_URING, directory entries are also read in batches, and
+ * the lstat() and getxattr() calls for all entries of a batch are queued
+ * on an io_uring at once. Objects are passed to the callback as soon as
+ * all their operations have completed, and the callback can pick up the
+ * prefetched attributes with walk_tree_xattr(). Symlinks, and anything
+ * the ring could not handle, go through the synchronous path.
+ */
+
+#define WALK_TREE_BATCH		64
+#define WALK_TREE_MAX_BATCH	4096
+#define WALK_TREE_OPS		(1 + WALK_TREE_MAX_XATTRS)
+#define NOT_FETCHED		(-(ssize_t)1 << 30)
+
+struct walk_item {
+	size_t path;		/* offset into the chunk's path buffer */
+	ino_t ino;		/* d_ino */
+	unsigned char type;	/* d_type */
+	unsigned char descend;	/* recurse into this directory */
+	unsigned char deferred;	/* use the synchronous path */
+#if defined(STATX_BASIC_STATS)
+	int pending;		/* operations still in flight */
+	int stat_res;		/* 0, a negative errno value, or NOT_FETCHED */
+	struct statx stx;
+	struct {
+		ssize_t size;	/* value size, -errno, or NOT_FETCHED */
+		char value[WALK_TREE_XATTR_SIZE];
+	} xattr[WALK_TREE_MAX_XATTRS];
+#endif
+};
+
+struct walk_chunk {
+	struct walk_item *items;
+	unsigned int n, size;
+	char *paths;
+	size_t paths_size, paths_used;
 };
-struct entry_handle *closed = &head;
-unsigned int num_dir_handles;
+
+static unsigned int walk_batch = WALK_TREE_BATCH;
+
+/*
+ * Exclude patterns are classified once when they are added: patterns
+ * without wildcards are compared as strings, and only patterns that
+ * contain a slash are matched against the whole path instead of the
+ * last pathname component.
+ */
+#define EXCLUDE_LITERAL		0x01
+#define EXCLUDE_PATH		0x02
+
+static struct {
+	char *pattern;
+	int flags;
+} *excludes;
+static unsigned int num_excludes;
+
+static int max_depth = -1;
+static __thread dev_t root_dev;
+
+#if defined(STATX_BASIC_STATS)
+/*
+ * The ring is kept for the next walk in idle_ring. A walk that starts
+ * while another thread is using the ring sets up a ring of its own.
+ */
+static struct uring *idle_ring;
+static int ring_failed;
+static __thread struct uring *ring;
+static __thread const struct walk_item *current_item;
+#endif
+
+static int walk_tree_rec(char *path, int walk_flags,
+			 int (*func)(const char *, const struct stat *, int,
+				     void *), void *arg, int depth);
 
 static int walk_tree_visited(dev_t dev, ino_t ino)
 {
@@ -55,7 +155,515 @@ static int walk_tree_visited(dev_t dev, ino_t ino)
 	return 0;
 }
 
-static int walk_tree_rec(const char *path, int walk_flags,
+/*
+ * Reopen the directory handle of DIR if it was closed while we ran out of
+ * file descriptors further down the tree.
+ */
+static int walk_tree_reopen(const char *path, struct entry_handle *dir)
+{
+	if (dir->stream)
+		return 0;
+	dir->stream = opendir(path);
+	if (!dir->stream)
+		return -1;
+	seekdir(dir->stream, dir->pos);
+
+	closed = closed->next;
+	num_dir_handles--;
+	return 0;
+}
+
+#if defined(_DIRENT_HAVE_D_TYPE)
+# define ENTRY_TYPE(entry) ((entry)->d_type)
+#else
+# define ENTRY_TYPE(entry) DT_UNKNOWN
+#endif
+
+static int walk_tree_add_item(struct walk_chunk *chunk, const char *path,
+			      const struct dirent *entry)
+{
+	size_t len = strlen(path) + 1 + strlen(entry->d_name) + 1;
+	struct walk_item *item;
+
+	if (chunk->paths_used + len > chunk->paths_size) {
+		size_t size = 2 * chunk->paths_size + len;
+		char *paths = realloc(chunk->paths, size);
+
+		if (!paths)
+			return -1;
+		chunk->paths = paths;
+		chunk->paths_size = size;
+	}
+	item = &chunk->items[chunk->n++];
+	item->path = chunk->paths_used;
+	sprintf(chunk->paths + item->path, "%s/%s", path, entry->d_name);
+	chunk->paths_used += len;
+	item->ino = entry->d_ino;
+	item->type = ENTRY_TYPE(entry);
+	item->descend = 0;
+	item->deferred = 1;
+	return 0;
+}
+
+static __thread const char *walk_chunk_paths;
+
+static int walk_item_ino_cmp(const void *a, const void *b)
+{
+	const struct walk_item *item_a = a, *item_b = b;
+
+	return (item_a->ino > item_b->ino) - (item_a->ino < item_b->ino);
+}
+
+static int walk_item_name_cmp(const void *a, const void *b)
+{
+	const struct walk_item *item_a = a, *item_b = b;
+
+	/* All paths in a chunk share the same directory prefix. */
+	return strcmp(walk_chunk_paths + item_a->path,
+		      walk_chunk_paths + item_b->path);
+}
+
+static int walk_tree_excluded(const char *path, const char *name)
+{
+	unsigned int n;
+
+	for (n = 0; n < num_excludes; n++) {
+		const char *str = (excludes[n].flags & EXCLUDE_PATH) ?
+				  path : name;
+
+		if (excludes[n].flags & EXCLUDE_LITERAL) {
+			if (strcmp(excludes[n].pattern, str) == 0)
+				return 1;
+		} else if (fnmatch(excludes[n].pattern, str, 0) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Check whether directory entry PATH can be skipped based on its name and
+ * type alone, without looking at the object itself.
+ */
+static int walk_tree_prune(const char *path, unsigned char type,
+			   int walk_flags)
+{
+	if (num_excludes &&
+	    walk_tree_excluded(path, strrchr(path, '/') + 1))
+		return 1;
+	if ((walk_flags & WALK_TREE_ONLY_DIRS) && type != DT_UNKNOWN &&
+	    type != DT_DIR && type != DT_LNK)
+		return 1;
+	return 0;
+}
+
+/* Check whether an object is to be passed to the callback. */
+static int walk_tree_wanted(const struct stat *st, int walk_flags)
+{
+	if ((walk_flags & WALK_TREE_ONLY_DIRS) && !S_ISDIR(st->st_mode))
+		return 0;
+	if ((walk_flags & WALK_TREE_ONLY_FILES) && !S_ISREG(st->st_mode))
+		return 0;
+	return 1;
+}
+
+#if defined(STATX_BASIC_STATS)
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/*
+ * Queue the operations for all entries in CHUNK, and wait for them to
+ * complete. Returns -1 if the ring has failed; the entries not visited
+ * yet are then marked as deferred. Operations may still be in flight, so
+ * the items and paths of CHUNK must not be reused or freed.
+ */
+static int walk_tree_fetch(struct entry_handle *dir, struct walk_chunk *chunk,
+			   int walk_flags,
+			   int (*func)(const char *, const struct stat *, int,
+				       void *), void *arg, int *err)
+{
+	int dfd = dirfd(dir->stream);
+	unsigned int i, x, in_flight = 0;
+
+	for (i = 0; i < chunk->n; i++) {
+		struct walk_item *item = &chunk->items[i];
+		const char *path = chunk->paths + item->path;
+
+		item->pending = 0;
+		item->deferred = 0;
+		item->stat_res = NOT_FETCHED;
+		if (uring_statx(ring, dfd, strrchr(path, '/') + 1,
+				AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS,
+				&item->stx, i * WALK_TREE_OPS) == 0)
+			item->pending++;
+		for (x = 0; x < WALK_TREE_MAX_XATTRS; x++) {
+			item->xattr[x].size = NOT_FETCHED;
+			if (x >= num_prefetch_xattrs || item->type == DT_LNK ||
+			    (prefetch_xattrs[x].dirs_only &&
+			     item->type != DT_DIR && item->type != DT_UNKNOWN))
+				continue;
+			if (uring_getxattr(ring, path, prefetch_xattrs[x].name,
+					   item->xattr[x].value,
+					   WALK_TREE_XATTR_SIZE,
+					   i * WALK_TREE_OPS + 1 + x) == 0)
+				item->pending++;
+		}
+		in_flight += item->pending;
+	}
+	if (in_flight && uring_submit(ring) != 0) {
+		for (i = 0; i < chunk->n; i++)
+			chunk->items[i].deferred = 1;
+		return -1;
+	}
+
+	/* Also takes care of entries for which nothing could be queued. */
+	i = 0;
+	while (in_flight || i < chunk->n) {
+		struct walk_item *item;
+		struct stat st;
+
+		if (i < chunk->n) {
+			item = &chunk->items[i++];
+			if (item->pending)
+				continue;
+		} else {
+			uint64_t user_data;
+			int res;
+
+			if (uring_wait(ring, &user_data, &res) != 0) {
+				for (i = 0; i < chunk->n; i++)
+					if (chunk->items[i].pending)
+						chunk->items[i].deferred = 1;
+				return -1;
+			}
+			in_flight--;
+			item = &chunk->items[user_data / WALK_TREE_OPS];
+			x = user_data % WALK_TREE_OPS;
+			if (x == 0)
+				item->stat_res = res;
+			else if (res >= 0 || res == -ENODATA)
+				item->xattr[x - 1].size = res;
+			if (--item->pending)
+				continue;
+		}
+
+		if (item->stat_res == NOT_FETCHED) {
+			item->deferred = 1;
+		} else if (item->stat_res < 0) {
+			errno = -item->stat_res;
+			*err += func(chunk->paths + item->path, NULL,
+				     walk_flags | WALK_TREE_FAILED, arg);
+		} else {
+			statx_to_stat(&item->stx, &st);
+			if (S_ISLNK(st.st_mode)) {
+				item->deferred = 1;
+				continue;
+			}
+			current_item = item;
+			if (walk_tree_wanted(&st, walk_flags))
+				*err += func(chunk->paths + item->path, &st,
+					     walk_flags, arg);
+			current_item = NULL;
+			if (S_ISDIR(st.st_mode))
+				item->descend = 1;
+		}
+	}
+	return 0;
+}
+
+#endif  /* STATX_BASIC_STATS */
+
+static int walk_tree_dir(char *path, int walk_flags,
+			 int (*func)(const char *, const struct stat *, int,
+				     void *), void *arg, int depth, int flags,
+			 const struct stat *dir_st);
+
+static int walk_tree_chunks(char *path, struct entry_handle *dir,
+			    int walk_flags,
+			    int (*func)(const char *, const struct stat *, int,
+					void *), void *arg, int depth, int flags)
+{
+	struct walk_chunk *chunk;
+	char *path_end = strchr(path, 0);
+	int err = 0;
+#if defined(STATX_BASIC_STATS)
+	int abandoned;
+#endif
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (chunk) {
+		chunk->size = walk_batch;
+		chunk->items = malloc(chunk->size * sizeof(*chunk->items));
+		if (!chunk->items) {
+			free(chunk);
+			chunk = NULL;
+		}
+	}
+	if (!chunk)
+		return func(path, NULL, flags | WALK_TREE_FAILED, arg);
+
+	for(;;) {
+		struct dirent *entry;
+		unsigned int i;
+		int pruned;
+
+		chunk->n = 0;
+		chunk->paths_used = 0;
+		while (chunk->n < chunk->size &&
+		       (entry = readdir(dir->stream)) != NULL) {
+			if (!strcmp(entry->d_name, ".") ||
+			    !strcmp(entry->d_name, ".."))
+				continue;
+			if ((path_end - path) + strlen(entry->d_name) + 1 >=
+			    FILENAME_MAX) {
+				errno = ENAMETOOLONG;
+				err += func(path, NULL,
+					    flags | WALK_TREE_FAILED, arg);
+				continue;
+			}
+			*path_end = '/';
+			strcpy(path_end + 1, entry->d_name);
+			pruned = walk_tree_prune(path, ENTRY_TYPE(entry),
+						 walk_flags);
+			*path_end = 0;
+			if (pruned)
+				continue;
+			if (walk_tree_add_item(chunk, path, entry) != 0) {
+				err += func(path, NULL,
+					    flags | WALK_TREE_FAILED, arg);
+				break;
+			}
+		}
+		if (chunk->n == 0)
+			break;
+
+		walk_chunk_paths = chunk->paths;
+		if (walk_flags & WALK_TREE_INODE_ORDER)
+			qsort(chunk->items, chunk->n, sizeof(*chunk->items),
+			      walk_item_ino_cmp);
+		else if (walk_flags & WALK_TREE_NAME_ORDER)
+			qsort(chunk->items, chunk->n, sizeof(*chunk->items),
+			      walk_item_name_cmp);
+
+#if defined(STATX_BASIC_STATS)
+		abandoned = 0;
+		if (ring && (walk_flags & WALK_TREE_URING) &&
+		    walk_tree_fetch(dir, chunk, walk_flags, func, arg,
+				    &err) != 0) {
+			/*
+			 * Give up on the ring, and walk the rest of the
+			 * directory through the synchronous path.
+			 */
+			ring = NULL;
+			__atomic_store_n(&ring_failed, 1, __ATOMIC_RELAXED);
+			abandoned = 1;
+		}
+#endif
+
+		for (i = 0; i < chunk->n; i++) {
+			struct walk_item *item = &chunk->items[i];
+			struct stat st;
+
+			if (!item->deferred && !item->descend)
+				continue;
+			strcpy(path_end, chunk->paths + item->path +
+					 (path_end - path));
+			if (item->deferred)
+				err += walk_tree_rec(path, walk_flags, func,
+						     arg, depth + 1);
+#if defined(STATX_BASIC_STATS)
+			else {
+				statx_to_stat(&item->stx, &st);
+				err += walk_tree_dir(path, walk_flags, func,
+						     arg, depth + 1,
+						     walk_flags, &st);
+			}
+#endif
+			*path_end = 0;
+		}
+
+#if defined(STATX_BASIC_STATS)
+		if (abandoned) {
+			/*
+			 * Operations may still be in flight, so the items
+			 * and paths of the chunk are left alone for good.
+			 */
+			chunk->items = malloc(chunk->size *
+					      sizeof(*chunk->items));
+			chunk->paths = NULL;
+			chunk->paths_size = 0;
+			if (!chunk->items) {
+				err += func(path, NULL,
+					    flags | WALK_TREE_FAILED, arg);
+				break;
+			}
+		}
+#endif
+
+		if (walk_tree_reopen(path, dir) != 0) {
+			err += func(path, NULL, flags | WALK_TREE_FAILED, arg);
+			break;
+		}
+	}
+	free(chunk->paths);
+	free(chunk->items);
+	free(chunk);
+	return err;
+}
+
+/*
+ * Read the directory PATH and walk all its entries. DIR_ST is the stat
+ * information of the directory, or NULL if we do not have it, yet.
+ */
+static int walk_tree_dir(char *path, int walk_flags,
+			 int (*func)(const char *, const struct stat *, int,
+				     void *), void *arg, int depth, int flags,
+			 const struct stat *dir_st)
+{
+	struct entry_handle dir;
+	struct stat st;
+	int err = 0;
+
+	/*
+	 * Check if we have already visited this directory to break
+	 * endless loops.
+	 *
+	 * If we haven't stat()ed the file yet, do an opendir() for
+	 * figuring out whether we have a directory, and check whether
+	 * the directory has been visited afterwards. This saves a
+	 * system call for each non-directory found.
+	 */
+	if (max_depth >= 0 && depth >= max_depth)
+		return 0;
+	if (dir_st) {
+		dir.dev = dir_st->st_dev;
+		dir.ino = dir_st->st_ino;
+		if (walk_tree_visited(dir.dev, dir.ino))
+			return 0;
+		if ((walk_flags & WALK_TREE_ONE_FILESYSTEM) &&
+		    dir.dev != root_dev)
+			return 0;
+	}
+
+	if (num_dir_handles == 0 && closed->prev != &head) {
+close_another_dir:
+		/* Close the topmost directory handle still open. */
+		closed = closed->prev;
+		closed->pos = telldir(closed->stream);
+		closedir(closed->stream);
+		closed->stream = NULL;
+		num_dir_handles++;
+	}
+
+	dir.stream = opendir(path);
+	if (!dir.stream) {
+		if (errno == ENFILE && closed->prev != &head) {
+			/* Ran out of file descriptors. */
+			num_dir_handles = 0;
+			goto close_another_dir;
+		}
+
+		/*
+		 * PATH may be a symlink to a regular file, or a dead
+		 * symlink which we didn't follow above.
+		 */
+		if (errno != ENOTDIR && errno != ENOENT)
+			err += func(path, NULL, flags | WALK_TREE_FAILED, arg);
+		return err;
+	}
+
+	/* See walk_tree_visited() comment above... */
+	if (!dir_st) {
+		if (stat(path, &st) != 0)
+			goto skip_dir;
+		dir.dev = st.st_dev;
+		dir.ino = st.st_ino;
+		if (walk_tree_visited(dir.dev, dir.ino))
+			goto skip_dir;
+		if ((walk_flags & WALK_TREE_ONE_FILESYSTEM) &&
+		    dir.dev != root_dev)
+			goto skip_dir;
+	}
+
+	/* Insert into the list of handles. */
+	dir.next = head.next;
+	dir.prev = &head;
+	dir.prev->next = &dir;
+	dir.next->prev = &dir;
+	num_dir_handles--;
+
+	if (!(walk_flags & WALK_TREE_POSTORDER) &&
+	    ((walk_flags & (WALK_TREE_INODE_ORDER | WALK_TREE_NAME_ORDER))
+#if defined(STATX_BASIC_STATS)
+	     || (ring && (walk_flags & WALK_TREE_URING))
+#endif
+	   ))
+		err += walk_tree_chunks(path, &dir, walk_flags, func, arg,
+					depth, flags);
+	else {
+		struct dirent *entry;
+
+		while ((entry = readdir(dir.stream)) != NULL) {
+			char *path_end;
+
+			if (!strcmp(entry->d_name, ".") ||
+			    !strcmp(entry->d_name, ".."))
+				continue;
+			path_end = strchr(path, 0);
+			if ((path_end - path) + strlen(entry->d_name) + 1 >=
+			    FILENAME_MAX) {
+				errno = ENAMETOOLONG;
+				err += func(path, NULL,
+					    flags | WALK_TREE_FAILED, arg);
+				continue;
+			}
+			*path_end++ = '/';
+			strcpy(path_end, entry->d_name);
+			if (!walk_tree_prune(path, ENTRY_TYPE(entry),
+					     walk_flags))
+				err += walk_tree_rec(path, walk_flags, func,
+						     arg, depth + 1);
+			*--path_end = 0;
+			if (walk_tree_reopen(path, &dir) != 0) {
+				err += func(path, NULL, flags |
+					    WALK_TREE_FAILED, arg);
+				break;
+			}
+		}
+	}
+
+	/* Remove from the list of handles. */
+	dir.prev->next = dir.next;
+	dir.next->prev = dir.prev;
+	num_dir_handles++;
+
+	if (!dir.stream)
+		return err;
+skip_dir:
+	if (closedir(dir.stream) != 0)
+		err += func(path, NULL, flags | WALK_TREE_FAILED, arg);
+	return err;
+}
+
+static int walk_tree_rec(char *path, int walk_flags,
 			 int (*func)(const char *, const struct stat *, int,
 				     void *), void *arg, int depth)
 {
@@ -64,7 +672,6 @@ static int walk_tree_rec(const char *path, int walk_flags,
 			       !(walk_flags & WALK_TREE_PHYSICAL) &&
 			       depth == 0);
 	int have_dir_stat = 0, flags = walk_flags, err;
-	struct entry_handle dir;
 	struct stat st;
 
 	/*
@@ -85,16 +692,16 @@ static int walk_tree_rec(const char *path, int walk_flags,
 			if (stat(path, &st) != 0)
 				return func(path, NULL,
 					    flags | WALK_TREE_FAILED, arg);
-			dir.dev = st.st_dev;
-			dir.ino = st.st_ino;
 			have_dir_stat = 1;
 		}
 	} else if (S_ISDIR(st.st_mode)) {
-		dir.dev = st.st_dev;
-		dir.ino = st.st_ino;
 		have_dir_stat = 1;
 	}
-	err = func(path, &st, flags, arg);
+	if (depth == 0)
+		root_dev = st.st_dev;
+	err = 0;
+	if (!(flags & WALK_TREE_POSTORDER) && walk_tree_wanted(&st, flags))
+		err += func(path, &st, flags, arg);
 
 	/*
 	 * Recurse if WALK_TREE_RECURSIVE and the path is:
@@ -103,108 +710,191 @@ static int walk_tree_rec(const char *path, int walk_flags,
 	 */
         if ((flags & WALK_TREE_RECURSIVE) &&
 	   (!(flags & WALK_TREE_SYMLINK) && S_ISDIR(st.st_mode)) ||
-	   ((flags & WALK_TREE_SYMLINK) && follow_symlinks)) {
-		struct dirent *entry;
+	   ((flags & WALK_TREE_SYMLINK) && follow_symlinks))
+		err += walk_tree_dir(path, walk_flags, func, arg, depth, flags,
+				     have_dir_stat ? &st : NULL);
+	if ((flags & WALK_TREE_POSTORDER) && walk_tree_wanted(&st, flags))
+		err += func(path, &st, flags, arg);
+	return err;
+}
 
-		/*
-		 * Check if we have already visited this directory to break
-		 * endless loops.
-		 *
-		 * If we haven't stat()ed the file yet, do an opendir() for
-		 * figuring out whether we have a directory, and check whether
-		 * the directory has been visited afterwards. This saves a
-		 * system call for each non-directory found.
-		 */
-		if (have_dir_stat && walk_tree_visited(dir.dev, dir.ino))
-			return err;
+/*
+ * Set the number of directory entries the walker reads and processes at
+ * a time when sorting entries or batching metadata reads.
+ */
+int walk_tree_set_batch(unsigned int batch)
+{
+	if (batch == 0 || batch > WALK_TREE_MAX_BATCH) {
+		errno = EINVAL;
+		return -1;
+	}
+	walk_batch = batch;
+	return 0;
+}
 
-		if (num_dir_handles == 0 && closed->prev != &head) {
-close_another_dir:
-			/* Close the topmost directory handle still open. */
-			closed = closed->prev;
-			closed->pos = telldir(closed->stream);
-			closedir(closed->stream);
-			closed->stream = NULL;
-			num_dir_handles++;
-		}
+/*
+ * Do not visit objects below the given depth. The objects passed to
+ * walk_tree() are at depth 0. A negative DEPTH removes the limit.
+ */
+void walk_tree_set_max_depth(int depth)
+{
+	max_depth = depth;
+}
 
-		dir.stream = opendir(path);
-		if (!dir.stream) {
-			if (errno == ENFILE && closed->prev != &head) {
-				/* Ran out of file descriptors. */
-				num_dir_handles = 0;
-				goto close_another_dir;
-			}
+/*
+ * Skip directory entries matching the shell wildcard PATTERN, and the
+ * subtrees below them. Patterns that contain a slash are matched against
+ * the path, others against the last component only.
+ */
+int walk_tree_exclude(const char *pattern)
+{
+	void *new_excludes;
+	char *copy;
+	int flags = 0;
 
-			/*
-			 * PATH may be a symlink to a regular file, or a dead
-			 * symlink which we didn't follow above.
-			 */
-			if (errno != ENOTDIR && errno != ENOENT)
-				err += func(path, NULL, flags |
-							WALK_TREE_FAILED, arg);
-			return err;
-		}
+	new_excludes = realloc(excludes,
+			       (num_excludes + 1) * sizeof(*excludes));
+	if (!new_excludes)
+		return -1;
+	excludes = new_excludes;
+	copy = strdup(pattern);
+	if (!copy)
+		return -1;
 
-		/* See walk_tree_visited() comment above... */
-		if (!have_dir_stat) {
-			if (stat(path, &st) != 0)
-				goto skip_dir;
-			dir.dev = st.st_dev;
-			dir.ino = st.st_ino;
-			if (walk_tree_visited(dir.dev, dir.ino))
-				goto skip_dir;
+	if (!strpbrk(pattern, "*?[\\"))
+		flags |= EXCLUDE_LITERAL;
+	if (strchr(pattern, '/'))
+		flags |= EXCLUDE_PATH;
+	excludes[num_excludes].pattern = copy;
+	excludes[num_excludes].flags = flags;
+	num_excludes++;
+	return 0;
+}
+
+/*
+ * Read exclude patterns from FILE, one per line. A FILE of "-" stands for
+ * standard input.
+ */
+int walk_tree_exclude_from(const char *file)
+{
+	FILE *stream = stdin;
+	char *line;
+	int error = 0;
+
+	if (strcmp(file, "-") != 0) {
+		stream = fopen(file, "r");
+		if (!stream)
+			return -1;
+	}
+	while ((line = next_line(stream)) != NULL) {
+		if (*line == '\0')
+			continue;
+		if (walk_tree_exclude(line) != 0) {
+			error = -1;
+			break;
 		}
+	}
+	if (!error && !feof(stream))
+		error = -1;
+	if (stream != stdin)
+		fclose(stream);
+	return error;
+}
 
-		/* Insert into the list of handles. */
-		dir.next = head.next;
-		dir.prev = &head;
-		dir.prev->next = &dir;
-		dir.next->prev = &dir;
-		num_dir_handles--;
+/*
+ * Handle one of the WALK_TREE_LONG_OPTIONS options. Returns 0 on success,
+ * -1 with errno set if ARG is invalid, and 1 if OPT is not a walk option.
+ */
+int walk_tree_option(int opt, const char *arg, int *walk_flags)
+{
+	char *end;
+	long depth;
 
-		while ((entry = readdir(dir.stream)) != NULL) {
-			char *path_end;
+	switch (opt) {
+		case WALK_TREE_OPT_ONE_FILESYSTEM:
+			*walk_flags |= WALK_TREE_ONE_FILESYSTEM;
+			return 0;
 
-			if (!strcmp(entry->d_name, ".") ||
-			    !strcmp(entry->d_name, ".."))
-				continue;
-			path_end = strchr(path, 0);
-			if ((path_end - path) + strlen(entry->d_name) + 1 >=
-			    FILENAME_MAX) {
-				errno = ENAMETOOLONG;
-				err += func(path, NULL,
-					    flags | WALK_TREE_FAILED, arg);
-				continue;
-			}
-			*path_end++ = '/';
-			strcpy(path_end, entry->d_name);
-			err += walk_tree_rec(path, walk_flags, func, arg,
-					     depth + 1);
-			*--path_end = 0;
-			if (!dir.stream) {
-				/* Reopen the directory handle. */
-				dir.stream = opendir(path);
-				if (!dir.stream)
-					return err + func(path, NULL, flags |
-						    WALK_TREE_FAILED, arg);
-				seekdir(dir.stream, dir.pos);
-
-				closed = closed->next;
-				num_dir_handles--;
-			}
-		}
+		case WALK_TREE_OPT_EXCLUDE:
+			return walk_tree_exclude(arg);
 
-		/* Remove from the list of handles. */
-		dir.prev->next = dir.next;
-		dir.next->prev = dir.prev;
-		num_dir_handles++;
+		case WALK_TREE_OPT_EXCLUDE_FROM:
+			return walk_tree_exclude_from(arg);
 
-	skip_dir:
-		if (closedir(dir.stream) != 0)
-			err += func(path, NULL, flags | WALK_TREE_FAILED, arg);
+		case WALK_TREE_OPT_TYPE:
+			*walk_flags &= ~(WALK_TREE_ONLY_DIRS |
+					 WALK_TREE_ONLY_FILES);
+			if (strcmp(arg, "d") == 0)
+				*walk_flags |= WALK_TREE_ONLY_DIRS;
+			else if (strcmp(arg, "f") == 0)
+				*walk_flags |= WALK_TREE_ONLY_FILES;
+			else
+				goto invalid;
+			return 0;
+
+		case WALK_TREE_OPT_MAX_DEPTH:
+			depth = strtol(arg, &end, 10);
+			if (*arg == '\0' || *end || depth < 0 ||
+			    depth > INT_MAX)
+				goto invalid;
+			walk_tree_set_max_depth(depth);
+			return 0;
+
+		default:
+			return 1;
 	}
-	return err;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Have the walker fetch extended attribute NAME together with the stat
+ * information when it can do so cheaply (see WALK_TREE_URING). With
+ * DIRS_ONLY, the attribute is only fetched for directories.
+ */
+int walk_tree_prefetch_xattr(const char *name, int dirs_only)
+{
+	if (num_prefetch_xattrs == WALK_TREE_MAX_XATTRS) {
+		errno = ENOSPC;
+		return -1;
+	}
+	prefetch_xattrs[num_prefetch_xattrs].name = name;
+	prefetch_xattrs[num_prefetch_xattrs].dirs_only = dirs_only;
+	num_prefetch_xattrs++;
+	return 0;
+}
+
+/*
+ * Look up a prefetched attribute of the object currently passed to the
+ * callback. Returns 1 and the value or a size of -1 with errno set to
+ * ENODATA if the attribute was fetched, and 0 if the caller must fetch
+ * the attribute itself.
+ */
+int walk_tree_xattr(const char *name, const void **value, ssize_t *size)
+{
+#if defined(STATX_BASIC_STATS)
+	unsigned int x;
+
+	if (!current_item)
+		return 0;
+	for (x = 0; x < num_prefetch_xattrs; x++) {
+		if (strcmp(prefetch_xattrs[x].name, name) != 0)
+			continue;
+		if (current_item->xattr[x].size == NOT_FETCHED)
+			return 0;
+		if (current_item->xattr[x].size < 0) {
+			errno = -current_item->xattr[x].size;
+			*size = -1;
+		} else {
+			*value = current_item->xattr[x].value;
+			*size = current_item->xattr[x].size;
+		}
+		return 1;
+	}
+#endif
+	return 0;
 }
 
 int walk_tree(const char *path, int walk_flags, unsigned int num,
@@ -212,7 +902,14 @@ int walk_tree(const char *path, int walk_flags, unsigned int num,
 	      void *arg)
 {
 	char path_copy[FILENAME_MAX];
+	int err;
 
+	if (walking) {
+		errno = EBUSY;
+		return func(path, NULL, WALK_TREE_FAILED, arg);
+	}
+	head.next = head.prev = &head;
+	closed = &head;
 	num_dir_handles = num;
 	if (num_dir_handles < 1) {
 		struct rlimit rlimit;
@@ -227,5 +924,30 @@ int walk_tree(const char *path, int walk_flags, unsigned int num,
 		return func(path, NULL, WALK_TREE_FAILED, arg);
 	}
 	strcpy(path_copy, path);
-	return walk_tree_rec(path_copy, walk_flags, func, arg, 0);
+#if defined(STATX_BASIC_STATS)
+	if ((walk_flags & WALK_TREE_URING) &&
+	    (walk_flags & WALK_TREE_RECURSIVE) &&
+	    !__atomic_load_n(&ring_failed, __ATOMIC_RELAXED)) {
+		ring = __atomic_exchange_n(&idle_ring, NULL, __ATOMIC_ACQUIRE);
+		if (!ring)
+			ring = uring_init(WALK_TREE_OPS * walk_batch);
+		if (!ring)
+			__atomic_store_n(&ring_failed, 1, __ATOMIC_RELAXED);
+	}
+#endif
+	walking = 1;
+	err = walk_tree_rec(path_copy, walk_flags, func, arg, 0);
+	walking = 0;
+#if defined(STATX_BASIC_STATS)
+	if (ring) {
+		struct uring *expected = NULL;
+
+		if (!__atomic_compare_exchange_n(&idle_ring, &expected, ring,
+						 0, __ATOMIC_RELEASE,
+						 __ATOMIC_RELAXED))
+			uring_exit(ring);
+		ring = NULL;
+	}
+#endif
+	return err;
 }
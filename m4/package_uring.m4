@@ -0,0 +1,21 @@
+dnl Checks for the io_uring interfaces used by the tree walker.
+dnl
+dnl This program is free software: you can redistribute it and/or modify it
+dnl under the terms of the GNU General Public License as published by
+dnl the Free Software Foundation, either version 2 of the License, or
+dnl (at your option) any later version.
+dnl
+dnl This program is distributed in the hope that it will be useful,
+dnl but WITHOUT ANY WARRANTY; without even the implied warranty of
+dnl MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+dnl GNU General Public License for more details.
+dnl
+dnl You should have received a copy of the GNU General Public License
+dnl along with this program.  If not, see <http://www.gnu.org/licenses/>.
+AC_DEFUN([AC_PACKAGE_WANT_IO_URING],
+  [ if test "$enable_io_uring" = yes; then
+        AC_CHECK_HEADERS([linux/io_uring.h])
+        AC_CHECK_DECLS([IORING_OP_STATX, IORING_OP_GETXATTR],,,
+                       [#include <linux/io_uring.h>])
+    fi
+  ])
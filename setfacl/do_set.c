@@ -33,11 +33,16 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <ftw.h>
+#include <endian.h>
+#include <attr/xattr.h>
+#include <pthread.h>
 #include "sequence.h"
 #include "do_set.h"
 #include "parse.h"
 #include "config.h"
 #include "walk_tree.h"
+#include "misc.h"
+#include "acl_ea.h"
 
 
 extern const char *progname;
@@ -45,6 +50,64 @@ extern int opt_recalculate;
 extern int opt_test;
 extern int print_options;
 
+/* Number of results remembered in a memo table, and of hash buckets */
+#define MEMO_SIZE	1024
+
+/* The name of a file in error messages */
+#define ERROR_NAME(args, path_p) ((args)->name ? (args)->name : (path_p))
+
+/*
+ * An extended attribute read before the ACL is needed. SIZE is -1 if the
+ * attribute was not read, and 0 if the file does not have it.
+ */
+struct xattr_value {
+	void *value;
+	size_t alloc;
+	ssize_t size;
+};
+
+/*
+ * do_set() may run in several threads; its buffers are per thread, and
+ * are released by do_set_release().
+ */
+static __thread struct xattr_value input[2];  /* access and default ACL */
+static __thread void *edit_in, *edit_out;     /* edited attributes */
+static __thread size_t edit_in_size, edit_out_size;
+static __thread void *acl_buf;                /* retrieve_acl() */
+static __thread size_t acl_buf_size;
+static __thread void *key_buf;                /* memo_key() */
+static __thread size_t key_buf_size;
+
+/* The hard linked files of a sequence may be shared between threads. */
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The initial state of a file, followed by its ACL attributes */
+struct memo_key {
+	mode_t mode;		/* permissions if there is no access ACL */
+	int is_dir;
+	ssize_t size[2];
+};
+
+struct memo_entry {
+	struct memo_entry *next;
+	unsigned int hash;
+	size_t key_size;
+	void *key;
+	void *acl_value;	/* NULL if unchanged */
+	size_t acl_size;
+	int equiv_mode;
+	mode_t mode;
+	void *default_value;	/* NULL if unchanged */
+	size_t default_size;	/* 0 to remove the default ACL */
+};
+
+/* Entries are only added while the table exists, under the lock. */
+struct do_set_memo {
+	pthread_mutex_t lock;
+	struct memo_entry *hash[MEMO_SIZE];
+	size_t num_entries;
+};
+
 acl_entry_t
 find_entry(
 	acl_t acl,
@@ -121,6 +184,271 @@ clone_entry(
 }
 
 
+static int
+entry_cmp(
+	acl_tag_t tag1,
+	id_t id1,
+	acl_tag_t tag2,
+	id_t id2)
+{
+	if (tag1 != tag2)
+		return tag1 < tag2 ? -1 : 1;
+	if (tag1 != ACL_USER && tag1 != ACL_GROUP)
+		return 0;
+	if (id1 != id2)
+		return id1 < id2 ? -1 : 1;
+	return 0;
+}
+
+
+static int
+edit_cmp(
+	const void *a,
+	const void *b)
+{
+	const struct do_set_edit *ea = a, *eb = b;
+	int cmp = entry_cmp(ea->tag, ea->id, eb->tag, eb->id);
+
+	if (cmp)
+		return cmp;
+	return ea->order < eb->order ? -1 : 1;
+}
+
+
+static struct do_set_stage *
+add_stage(
+	struct do_set_plan *plan,
+	cmd_tag_t cmd,
+	acl_type_t type)
+{
+	struct do_set_stage *stages, *stage;
+
+	stages = realloc(plan->stages,
+			 (plan->num_stages + 1) * sizeof(*stages));
+	if (!stages)
+		return NULL;
+	plan->stages = stages;
+	stage = &stages[plan->num_stages++];
+	stage->cmd = cmd;
+	stage->type = type;
+	stage->edits = NULL;
+	stage->num_edits = 0;
+	return stage;
+}
+
+
+/*
+ * Compile a command sequence. Entry commands on the same ACL type are
+ * merged into one stage until a command that removes entries wholesale,
+ * or a conditional execute permission (`X') which depends on the state
+ * of the ACL at that point in the sequence. Later commands on the same
+ * entry override earlier ones.
+ */
+struct do_set_plan *
+do_set_compile(
+	seq_t seq)
+{
+	ssize_t current[2] = { -1, -1 };  /* open stage per ACL type */
+	struct do_set_plan *plan;
+	size_t n, order = 0;
+	cmd_t cmd;
+	int error;
+
+	plan = calloc(1, sizeof(*plan));
+	if (!plan)
+		return NULL;
+
+	error = seq_get_cmd(seq, SEQ_FIRST_CMD, &cmd);
+	while (error == 1) {
+		int t = (cmd->c_type == ACL_TYPE_DEFAULT);
+		struct do_set_stage *stage = NULL;
+		struct do_set_edit *edit;
+
+		/* add_stage() may move the stages around. */
+		if (current[t] != -1)
+			stage = &plan->stages[current[t]];
+
+		switch(cmd->c_cmd) {
+			case CMD_ENTRY_REPLACE:
+			case CMD_REMOVE_ENTRY:
+				if (cmd->c_tag == ACL_MASK) {
+					if (t)
+						plan->default_acl_mask_provided = 1;
+					else
+						plan->acl_mask_provided = 1;
+				}
+				if (stage && cmd->c_cmd == CMD_ENTRY_REPLACE &&
+				    (cmd->c_perm & CMD_PERM_COND_EXECUTE))
+					stage = NULL;
+				if (!stage) {
+					stage = add_stage(plan, CMD_ENTRY_REPLACE,
+							  cmd->c_type);
+					if (!stage)
+						goto fail;
+					current[t] = plan->num_stages - 1;
+				}
+				edit = realloc(stage->edits,
+					       (stage->num_edits + 1) *
+					       sizeof(*edit));
+				if (!edit)
+					goto fail;
+				stage->edits = edit;
+				edit += stage->num_edits++;
+				edit->tag = cmd->c_tag;
+				edit->id = cmd->c_id;
+				edit->cmd = cmd->c_cmd;
+				edit->perm = cmd->c_perm;
+				edit->order = order++;
+				break;
+
+			case CMD_REMOVE_EXTENDED_ACL:
+			case CMD_REMOVE_ACL:
+				if (!add_stage(plan, cmd->c_cmd, cmd->c_type))
+					goto fail;
+				current[t] = -1;
+				break;
+
+			default:
+				errno = EINVAL;
+				goto fail;
+		}
+		if (t)
+			plan->default_acl_modified = 1;
+		else
+			plan->acl_modified = 1;
+
+		error = seq_get_cmd(seq, SEQ_NEXT_CMD, &cmd);
+	}
+	if (error < 0)
+		goto fail;
+
+	/* Sort the edits of each stage, and keep the last one per entry. */
+	for (n = 0; n < plan->num_stages; n++) {
+		struct do_set_stage *stage = &plan->stages[n];
+		size_t i, j = 0;
+
+		qsort(stage->edits, stage->num_edits, sizeof(*stage->edits),
+		      edit_cmp);
+		for (i = 0; i < stage->num_edits; i++) {
+			if (i + 1 < stage->num_edits &&
+			    entry_cmp(stage->edits[i].tag, stage->edits[i].id,
+				      stage->edits[i + 1].tag,
+				      stage->edits[i + 1].id) == 0)
+				continue;
+			stage->edits[j++] = stage->edits[i];
+		}
+		stage->num_edits = j;
+	}
+	return plan;
+
+fail:
+	do_set_free(plan);
+	return NULL;
+}
+
+
+void
+do_set_free(
+	struct do_set_plan *plan)
+{
+	size_t n;
+
+	if (!plan)
+		return;
+	for (n = 0; n < plan->num_stages; n++)
+		free(plan->stages[n].edits);
+	free(plan->stages);
+	free(plan);
+}
+
+
+/*
+ * Apply a stage of edits to an ACL. Both are sorted, so the edited ACL
+ * results from a single merge of the two in their extended attribute
+ * representation.
+ */
+static int
+apply_edits(
+	acl_t *xacl,
+	const struct do_set_stage *stage,
+	const struct stat *st)
+{
+	const acl_ea_entry *in, *in_end;
+	acl_ea_entry *out;
+	size_t n = 0;
+	ssize_t size;
+	int execute;
+	acl_t acl;
+
+	size = acl_to_xattr(*xacl, edit_in, edit_in_size);
+	if (size < 0)
+		return -1;
+	if ((size_t)size > edit_in_size) {
+		if (high_water_alloc(&edit_in, &edit_in_size, size))
+			return -1;
+		acl_to_xattr(*xacl, edit_in, edit_in_size);
+	}
+	if (high_water_alloc(&edit_out, &edit_out_size,
+			     size + stage->num_edits * sizeof(acl_ea_entry)))
+		return -1;
+	in = ((acl_ea_header *)edit_in)->a_entries;
+	in_end = in + acl_ea_count(size);
+	out = ((acl_ea_header *)edit_out)->a_entries;
+
+	/* Check for `X', and replace with `x' as appropriate. */
+	execute = S_ISDIR(st->st_mode);
+	for (; in != in_end && !execute; in++)
+		if (le16toh(in->e_perm) & ACL_EXECUTE)
+			execute = 1;
+	in = ((acl_ea_header *)edit_in)->a_entries;
+
+	while (in != in_end || n != stage->num_edits) {
+		const struct do_set_edit *edit = &stage->edits[n];
+		int cmp;
+
+		if (in == in_end)
+			cmp = 1;
+		else if (n == stage->num_edits)
+			cmp = -1;
+		else
+			cmp = entry_cmp(le16toh(in->e_tag),
+					le32toh(in->e_id),
+					edit->tag, edit->id);
+		if (cmp < 0) {
+			*out++ = *in++;
+			continue;
+		}
+		if (cmp == 0)
+			in++;
+		n++;
+		if (edit->cmd == CMD_ENTRY_REPLACE) {
+			mode_t perm = edit->perm;
+
+			if (perm & CMD_PERM_COND_EXECUTE) {
+				perm &= ~CMD_PERM_COND_EXECUTE;
+				if (execute)
+					perm |= CMD_PERM_EXECUTE;
+			}
+			out->e_tag = htole16(edit->tag);
+			out->e_perm = htole16(perm);
+			if (edit->tag == ACL_USER || edit->tag == ACL_GROUP)
+				out->e_id = htole32(edit->id);
+			else
+				out->e_id = htole32(ACL_UNDEFINED_ID);
+			out++;
+		}
+	}
+	((acl_ea_header *)edit_out)->a_version = htole32(ACL_EA_VERSION);
+
+	acl = acl_from_xattr(edit_out, (char *)out - (char *)edit_out);
+	if (!acl)
+		return -1;
+	acl_free(*xacl);
+	*xacl = acl;
+	return 0;
+}
+
+
 void
 print_test(
 	FILE *file,
@@ -142,42 +470,143 @@ print_test(
 }
 
 
-static void
-set_perm(
-	acl_entry_t ent,
-	mode_t perm)
+/*
+ * The file operations below go through the file descriptor FD if the
+ * file is open, and through the path name otherwise.
+ */
+
+static int
+read_xattr(
+	const char *path_p,
+	int fd,
+	const char *name,
+	struct xattr_value *xv)
 {
-	acl_permset_t set;
+	ssize_t size;
 
-	acl_get_permset(ent, &set);
-	if (perm & CMD_PERM_READ)
-		acl_add_perm(set, ACL_READ);
-	else
-		acl_delete_perm(set, ACL_READ);
-	if (perm & CMD_PERM_WRITE)
-		acl_add_perm(set, ACL_WRITE);
-	else
-		acl_delete_perm(set, ACL_WRITE);
-	if (perm & CMD_PERM_EXECUTE)
-		acl_add_perm(set, ACL_EXECUTE);
-	else
-		acl_delete_perm(set, ACL_EXECUTE);
+	if (high_water_alloc(&xv->value, &xv->alloc, acl_ea_size(16)))
+		return -1;
+	for(;;) {
+		if (fd != -1)
+			size = fgetxattr(fd, name, xv->value, xv->alloc);
+		else
+			size = getxattr(path_p, name, xv->value, xv->alloc);
+		if (size != -1 || errno != ERANGE)
+			break;
+		if (fd != -1)
+			size = fgetxattr(fd, name, NULL, 0);
+		else
+			size = getxattr(path_p, name, NULL, 0);
+		if (size <= 0)
+			break;
+		if (high_water_alloc(&xv->value, &xv->alloc, size))
+			return -1;
+	}
+	if (size == -1) {
+		if (errno != ENOATTR && errno != ENODATA)
+			return -1;
+		size = 0;
+	}
+	xv->size = size;
+	return 0;
+}
+
+
+static int
+set_xattr(
+	const char *path_p,
+	int fd,
+	const char *name,
+	const void *value,
+	size_t size)
+{
+	if (fd != -1)
+		return fsetxattr(fd, name, value, size, 0);
+	return setxattr(path_p, name, value, size, 0);
+}
+
+
+static int
+set_acl(
+	const char *path_p,
+	int fd,
+	acl_type_t type,
+	acl_t acl)
+{
+	ssize_t size;
+	void *value;
+	int error;
+
+	if (fd == -1)
+		return acl_set_file(path_p, type, acl);
+	if (type == ACL_TYPE_ACCESS)
+		return acl_set_fd(fd, acl);
+	size = acl_to_xattr(acl, NULL, 0);
+	if (size < 0)
+		return -1;
+	value = malloc(size);
+	if (!value)
+		return -1;
+	acl_to_xattr(acl, value, size);
+	error = fsetxattr(fd, ACL_EA_DEFAULT, value, size, 0);
+	free(value);
+	return error;
+}
+
+
+static int
+delete_default_acl(
+	const char *path_p,
+	int fd)
+{
+	if (fd == -1)
+		return acl_delete_def_file(path_p);
+	if (fremovexattr(fd, ACL_EA_DEFAULT) != 0 &&
+	    errno != ENOATTR && errno != ENODATA)
+		return -1;
+	return 0;
+}
+
+
+static int
+change_mode(
+	const char *path_p,
+	int fd,
+	mode_t mode)
+{
+	if (fd != -1)
+		return fchmod(fd, mode);
+	return chmod(path_p, mode);
 }
 
 
 static int
 retrieve_acl(
 	const char *path_p,
+	int fd,
 	acl_type_t type,
 	const struct stat *st,
+	struct xattr_value *in,
 	acl_t *old_acl,
 	acl_t *acl)
 {
 	if (*acl)
 		return 0;
 	*acl = NULL;
-	if (type == ACL_TYPE_ACCESS || S_ISDIR(st->st_mode)) {
-		*old_acl = acl_get_file(path_p, type);
+	if (in->size < 0 && fd != -1 &&
+	    (type == ACL_TYPE_ACCESS || S_ISDIR(st->st_mode)))
+		read_xattr(path_p, fd, type == ACL_TYPE_ACCESS ?
+				       ACL_EA_ACCESS : ACL_EA_DEFAULT, in);
+	if (in->size > 0)
+		*old_acl = acl_from_xattr(in->value, in->size);
+	else if (in->size == 0) {
+		if (type == ACL_TYPE_DEFAULT)
+			*old_acl = acl_init(0);
+		else
+			*old_acl = acl_from_mode(st->st_mode);
+	} else if (type == ACL_TYPE_ACCESS || S_ISDIR(st->st_mode)) {
+		*old_acl = acl_get_file_buf(path_p, type, st, &acl_buf,
+					    &acl_buf_size);
 		if (*old_acl == NULL && (errno == ENOSYS || errno == ENOTSUP)) {
 			if (type == ACL_TYPE_DEFAULT)
 				*old_acl = acl_init(0);
@@ -195,6 +624,511 @@ retrieve_acl(
 }
 
 
+/*
+ * Read the ACLs of a file that the plan depends on, and build the memo
+ * key from them. Returns the size of the key, or 0 if the ACLs cannot be
+ * read; the file is then processed without the memo table.
+ */
+static size_t
+memo_key(
+	const char *path_p,
+	int fd,
+	const struct stat *st,
+	const struct do_set_plan *plan,
+	void **key_p)
+{
+	struct memo_key header;
+	size_t size;
+
+	if (plan->acl_modified ||
+	    (S_ISDIR(st->st_mode) && plan->default_acl_modified)) {
+		if (read_xattr(path_p, fd, ACL_EA_ACCESS, &input[0]) != 0)
+			goto fail;
+	}
+	if (S_ISDIR(st->st_mode) && plan->default_acl_modified) {
+		if (read_xattr(path_p, fd, ACL_EA_DEFAULT, &input[1]) != 0)
+			goto fail;
+	}
+
+	memset(&header, 0, sizeof(header));
+	if (input[0].size == 0)
+		header.mode = st->st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+	header.is_dir = S_ISDIR(st->st_mode);
+	header.size[0] = input[0].size;
+	header.size[1] = input[1].size;
+	size = sizeof(header);
+	if (input[0].size > 0)
+		size += input[0].size;
+	if (input[1].size > 0)
+		size += input[1].size;
+	if (high_water_alloc(&key_buf, &key_buf_size, size))
+		goto fail;
+	memcpy(key_buf, &header, sizeof(header));
+	size = sizeof(header);
+	if (input[0].size > 0) {
+		memcpy((char *)key_buf + size, input[0].value, input[0].size);
+		size += input[0].size;
+	}
+	if (input[1].size > 0) {
+		memcpy((char *)key_buf + size, input[1].value, input[1].size);
+		size += input[1].size;
+	}
+	*key_p = key_buf;
+	return size;
+
+fail:
+	input[0].size = input[1].size = -1;
+	return 0;
+}
+
+
+static unsigned int
+memo_hash(
+	const void *key,
+	size_t size)
+{
+	const unsigned char *p = key;
+	unsigned int hash = 2166136261U;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+
+struct do_set_memo *
+do_set_memo_create(void)
+{
+	struct do_set_memo *memo;
+
+	memo = calloc(1, sizeof(*memo));
+	if (memo)
+		pthread_mutex_init(&memo->lock, NULL);
+	return memo;
+}
+
+
+void
+do_set_memo_free(
+	struct do_set_memo *memo)
+{
+	struct memo_entry *entry;
+	size_t n;
+
+	if (!memo)
+		return;
+	for (n = 0; n < MEMO_SIZE; n++) {
+		while ((entry = memo->hash[n])) {
+			memo->hash[n] = entry->next;
+			free(entry);
+		}
+	}
+	pthread_mutex_destroy(&memo->lock);
+	free(memo);
+}
+
+
+/* Release the buffers of the calling thread. */
+void
+do_set_release(void)
+{
+	free(input[0].value);
+	free(input[1].value);
+	memset(input, 0, sizeof(input));
+	free(edit_in);
+	free(edit_out);
+	edit_in = edit_out = NULL;
+	edit_in_size = edit_out_size = 0;
+	free(acl_buf);
+	acl_buf = NULL;
+	acl_buf_size = 0;
+	free(key_buf);
+	key_buf = NULL;
+	key_buf_size = 0;
+}
+
+
+static const struct memo_entry *
+memo_lookup(
+	struct do_set_memo *memo,
+	const void *key,
+	size_t key_size,
+	unsigned int hash)
+{
+	const struct memo_entry *entry;
+
+	pthread_mutex_lock(&memo->lock);
+	for (entry = memo->hash[hash % MEMO_SIZE]; entry; entry = entry->next)
+		if (entry->hash == hash && entry->key_size == key_size &&
+		    memcmp(entry->key, key, key_size) == 0)
+			break;
+	pthread_mutex_unlock(&memo->lock);
+	return entry;
+}
+
+
+/*
+ * Remember the ACLs to set for a key; NULL stands for an unchanged ACL.
+ * The memo table is only an optimization, so errors are ignored.
+ */
+static void
+memo_insert(
+	struct do_set_memo *memo,
+	const struct stat *st,
+	const void *key,
+	size_t key_size,
+	unsigned int hash,
+	acl_t acl,
+	acl_t default_acl)
+{
+	struct memo_entry *entry;
+	ssize_t acl_size = 0, default_size = 0;
+	char *p;
+
+	if (!S_ISDIR(st->st_mode)) {
+		/* Setting a default ACL fails; do not remember that. */
+		if (default_acl && acl_entries(default_acl) != 0)
+			return;
+		default_acl = NULL;
+	}
+	if (acl) {
+		acl_size = acl_to_xattr(acl, NULL, 0);
+		if (acl_size < 0)
+			return;
+	}
+	if (default_acl && acl_entries(default_acl) != 0) {
+		default_size = acl_to_xattr(default_acl, NULL, 0);
+		if (default_size < 0)
+			return;
+	}
+
+	entry = malloc(sizeof(*entry) + key_size + acl_size + default_size);
+	if (!entry)
+		return;
+	p = (char *)(entry + 1);
+	entry->hash = hash;
+	entry->key_size = key_size;
+	entry->key = p;
+	memcpy(p, key, key_size);
+	p += key_size;
+	entry->acl_value = NULL;
+	entry->acl_size = acl_size;
+	entry->equiv_mode = 0;
+	entry->mode = 0;
+	if (acl) {
+		entry->acl_value = p;
+		acl_to_xattr(acl, p, acl_size);
+		entry->equiv_mode = acl_equiv_mode(acl, &entry->mode);
+		p += acl_size;
+	}
+	entry->default_value = NULL;
+	entry->default_size = default_size;
+	if (default_acl) {
+		entry->default_value = p;
+		if (default_size)
+			acl_to_xattr(default_acl, p, default_size);
+	}
+	pthread_mutex_lock(&memo->lock);
+	if (memo->num_entries == MEMO_SIZE) {
+		pthread_mutex_unlock(&memo->lock);
+		free(entry);
+		return;
+	}
+	entry->next = memo->hash[hash % MEMO_SIZE];
+	memo->hash[hash % MEMO_SIZE] = entry;
+	memo->num_entries++;
+	pthread_mutex_unlock(&memo->lock);
+}
+
+
+/* Set the ACLs of a file as remembered in a memo table entry. */
+static int
+apply_memo(
+	const char *path_p,
+	const struct stat *st,
+	const struct memo_entry *entry,
+	struct do_set_args *args)
+{
+	if (opt_test) {
+		acl_t acl = NULL, default_acl = NULL;
+
+		if (entry->acl_value)
+			acl = acl_from_xattr(entry->acl_value,
+					     entry->acl_size);
+		if (entry->default_value)
+			default_acl = entry->default_size ?
+				acl_from_xattr(entry->default_value,
+					       entry->default_size) :
+				acl_init(0);
+		print_test(stdout, path_p, st, acl, default_acl);
+		if (acl)
+			acl_free(acl);
+		if (default_acl)
+			acl_free(default_acl);
+		return 0;
+	}
+	if (entry->acl_value) {
+		if (set_xattr(path_p, args->fd, ACL_EA_ACCESS,
+			      entry->acl_value, entry->acl_size) != 0) {
+			if (errno == ENOSYS || errno == ENOTSUP) {
+				if (entry->equiv_mode != 0)
+					goto fail;
+				else if (change_mode(path_p, args->fd,
+						     entry->mode) != 0)
+					goto fail;
+			} else
+				goto fail;
+		}
+		args->mode = entry->mode;
+	}
+	if (entry->default_value) {
+		if (entry->default_size == 0) {
+			if (delete_default_acl(path_p, args->fd) != 0 &&
+			    errno != ENOSYS && errno != ENOTSUP)
+				goto fail;
+		} else {
+			if (set_xattr(path_p, args->fd, ACL_EA_DEFAULT,
+				      entry->default_value,
+				      entry->default_size) != 0)
+				goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	fprintf(stderr, "%s: %s: %s\n", progname, ERROR_NAME(args, path_p),
+		strerror(errno));
+	return 1;
+}
+
+
+/*
+ * Read an ACL attribute of a file. File systems without ACL support have
+ * no ACLs.
+ */
+static int
+read_acl_xattr(
+	const char *path_p,
+	int fd,
+	const char *name,
+	struct xattr_value *xv)
+{
+	if (read_xattr(path_p, fd, name, xv) != 0) {
+		if (errno != ENOSYS && errno != ENOTSUP)
+			return -1;
+		xv->size = 0;
+	}
+	return 0;
+}
+
+
+struct do_set_reference *
+do_set_reference_read(
+	const char *path_p)
+{
+	struct xattr_value xv[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+	struct do_set_reference *ref = NULL;
+	struct stat st;
+	acl_t acl = NULL;
+	ssize_t acl_size;
+	int saved_errno;
+
+	if (stat(path_p, &st) != 0)
+		return NULL;
+	if (read_acl_xattr(path_p, -1, ACL_EA_ACCESS, &xv[0]) != 0)
+		goto out;
+	if (S_ISDIR(st.st_mode) &&
+	    read_acl_xattr(path_p, -1, ACL_EA_DEFAULT, &xv[1]) != 0)
+		goto out;
+
+	/* Without an access ACL, the permissions stand for one. */
+	if (xv[0].size > 0) {
+		acl = acl_from_xattr(xv[0].value, xv[0].size);
+		acl_size = xv[0].size;
+	} else {
+		acl = acl_from_mode(st.st_mode);
+		acl_size = acl_to_xattr(acl, NULL, 0);
+	}
+	if (!acl || acl_size < 0)
+		goto out;
+
+	ref = malloc(sizeof(*ref) + acl_size + xv[1].size);
+	if (!ref)
+		goto out;
+	ref->acl_value = ref + 1;
+	ref->acl_size = acl_size;
+	if (xv[0].size > 0)
+		memcpy(ref->acl_value, xv[0].value, acl_size);
+	else
+		acl_to_xattr(acl, ref->acl_value, acl_size);
+	ref->equiv_mode = acl_equiv_mode(acl, &ref->mode);
+	ref->default_value = (char *)ref->acl_value + acl_size;
+	ref->default_size = xv[1].size;
+	if (xv[1].size)
+		memcpy(ref->default_value, xv[1].value, xv[1].size);
+
+out:
+	saved_errno = errno;
+	if (acl)
+		acl_free(acl);
+	free(xv[0].value);
+	free(xv[1].value);
+	errno = saved_errno;
+	return ref;
+}
+
+
+void
+do_set_reference_free(
+	struct do_set_reference *ref)
+{
+	free(ref);
+}
+
+
+/*
+ * Copy the ACLs of a reference file. Attributes which already have the
+ * values of the reference are not written again.
+ */
+static int
+apply_reference(
+	const char *path_p,
+	const struct stat *st,
+	int walk_flags,
+	struct do_set_args *args)
+{
+	const struct do_set_reference *ref = args->reference;
+	int set_access, set_default = 0;
+
+	if (read_acl_xattr(path_p, args->fd, ACL_EA_ACCESS, &input[0]) != 0)
+		goto fail;
+	if (input[0].size > 0)
+		set_access = (size_t)input[0].size != ref->acl_size ||
+			     memcmp(input[0].value, ref->acl_value,
+				    ref->acl_size) != 0;
+	else
+		set_access = ref->equiv_mode != 0 ||
+			     (st->st_mode & (S_IRWXU | S_IRWXG | S_IRWXO)) !=
+			     ref->mode;
+
+	/* Only directories can have default ACLs */
+	if (ref->default_size && S_ISDIR(st->st_mode)) {
+		if (read_acl_xattr(path_p, args->fd, ACL_EA_DEFAULT,
+				   &input[1]) != 0)
+			goto fail;
+		set_default = (size_t)input[1].size != ref->default_size ||
+			      memcmp(input[1].value, ref->default_value,
+				     ref->default_size) != 0;
+	} else if (ref->default_size && !(walk_flags & WALK_TREE_RECURSIVE))
+		set_default = 1;
+
+	if (opt_test) {
+		acl_t acl = NULL, default_acl = NULL;
+
+		if (set_access)
+			acl = acl_from_xattr(ref->acl_value, ref->acl_size);
+		if (set_default)
+			default_acl = acl_from_xattr(ref->default_value,
+						     ref->default_size);
+		print_test(stdout, path_p, st, acl, default_acl);
+		if (acl)
+			acl_free(acl);
+		if (default_acl)
+			acl_free(default_acl);
+		return 0;
+	}
+	if (set_access) {
+		if (set_xattr(path_p, args->fd, ACL_EA_ACCESS,
+			      ref->acl_value, ref->acl_size) != 0) {
+			if (errno == ENOSYS || errno == ENOTSUP) {
+				if (ref->equiv_mode != 0)
+					goto fail;
+				else if (change_mode(path_p, args->fd,
+						     ref->mode) != 0)
+					goto fail;
+			} else
+				goto fail;
+		}
+		args->mode = ref->mode;
+	}
+	if (set_default) {
+		if (!S_ISDIR(st->st_mode)) {
+			fprintf(stderr, _("%s: %s: Only directories can have "
+					  "default ACLs\n"), progname,
+				ERROR_NAME(args, path_p));
+			return 1;
+		}
+		if (set_xattr(path_p, args->fd, ACL_EA_DEFAULT,
+			      ref->default_value, ref->default_size) != 0)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	fprintf(stderr, "%s: %s: %s\n", progname, ERROR_NAME(args, path_p),
+		strerror(errno));
+	return 1;
+}
+
+
+/*
+ * Rewrite the access ACL of a file in its minimal equivalent form, and
+ * count the attribute bytes that saves. An access ACL that becomes
+ * equivalent to the file mode is removed.
+ */
+static int
+apply_minimize(
+	const char *path_p,
+	const struct stat *st,
+	struct do_set_args *args)
+{
+	acl_t acl;
+	ssize_t acl_size;
+	int equiv_mode, error;
+
+	if (read_acl_xattr(path_p, args->fd, ACL_EA_ACCESS, &input[0]) != 0)
+		goto fail;
+	if (input[0].size == 0)
+		return 0;
+	acl = acl_from_xattr(input[0].value, input[0].size);
+	if (!acl)
+		goto fail;
+	error = acl_minimize(acl);
+	if (error <= 0) {
+		acl_free(acl);
+		if (error < 0)
+			goto fail;
+		return 0;
+	}
+	equiv_mode = acl_equiv_mode(acl, NULL);
+	acl_size = acl_to_xattr(acl, NULL, 0);
+	if (opt_test)
+		print_test(stdout, path_p, st, acl, NULL);
+	else if (acl_size < 0 ||
+		 high_water_alloc(&edit_out, &edit_out_size, acl_size) != 0)
+		error = -1;
+	else {
+		acl_to_xattr(acl, edit_out, acl_size);
+		error = set_xattr(path_p, args->fd, ACL_EA_ACCESS,
+				  edit_out, acl_size);
+	}
+	acl_free(acl);
+	if (error < 0)
+		goto fail;
+	args->minimize->files++;
+	args->minimize->saved += input[0].size -
+				 (equiv_mode == 0 ? 0 : acl_size);
+	return 0;
+
+fail:
+	fprintf(stderr, "%s: %s: %s\n", progname, ERROR_NAME(args, path_p),
+		strerror(errno));
+	return 1;
+}
+
+
 static int
 remove_extended_entries(
 	acl_t acl)
@@ -251,7 +1185,9 @@ remove_extended_entries(
 
 
 #define RETRIEVE_ACL(type) do { \
-	error = retrieve_acl(path_p, type, st, old_xacl, xacl); \
+	error = retrieve_acl(path_p, args->fd, type, st, \
+			     &input[type == ACL_TYPE_DEFAULT], \
+			     old_xacl, xacl); \
 	if (error) \
 		goto fail; \
 	} while(0)
@@ -267,16 +1203,18 @@ do_set(
 	acl_t old_acl = NULL, old_default_acl = NULL;
 	acl_t acl = NULL, default_acl = NULL;
 	acl_t *xacl, *old_xacl;
-	acl_entry_t ent;
-	cmd_t cmd;
+	const struct do_set_plan *plan;
+	const struct do_set_stage *stage;
 	int which_entry;
 	int errors = 0, error;
 	char *acl_text;
-	int acl_modified = 0, default_acl_modified = 0;
-	int acl_mask_provided = 0, default_acl_mask_provided = 0;
+	void *key = NULL;
+	size_t key_size = 0;
+	unsigned int hash = 0;
 
 	if (walk_flags & WALK_TREE_FAILED) {
-		fprintf(stderr, "%s: %s: %s\n", progname, path_p, strerror(errno));
+		fprintf(stderr, "%s: %s: %s\n", progname,
+			ERROR_NAME(args, path_p), strerror(errno));
 		return 1;
 	}
 
@@ -290,56 +1228,61 @@ do_set(
 	     !(walk_flags & (WALK_TREE_TOPLEVEL | WALK_TREE_LOGICAL))))
 		return 0;
 
-	/* Execute the commands in seq (read ACLs on demand) */
-	error = seq_get_cmd(args->seq, SEQ_FIRST_CMD, &cmd);
-	if (error == 0)
+	/*
+	 * All links to an inode end up with the same ACLs, so there is no
+	 * need to process them more than once.
+	 */
+	if (args->links && !S_ISDIR(st->st_mode) && st->st_nlink > 1) {
+		int done;
+
+		pthread_mutex_lock(&links_lock);
+		done = inode_set_add(args->links, st->st_dev, st->st_ino,
+				     NULL) == 1;
+		pthread_mutex_unlock(&links_lock);
+		if (done)
+			return 0;
+	}
+
+	if (args->reference)
+		return apply_reference(path_p, st, walk_flags, args);
+	if (args->minimize)
+		return apply_minimize(path_p, st, args);
+
+	/* Apply the compiled commands (read ACLs on demand) */
+	plan = args->plan;
+	if (plan->num_stages == 0)
 		return 0;
-	while (error == 1) {
-		mode_t perm = cmd->c_perm;
 
-		if (cmd->c_type == ACL_TYPE_ACCESS) {
+	/* Files which start out with the same ACLs end up with the same ACLs */
+	input[0].size = input[1].size = -1;
+	if (args->memo) {
+		key_size = memo_key(path_p, args->fd, st, plan, &key);
+		if (key_size) {
+			const struct memo_entry *entry;
+
+			hash = memo_hash(key, key_size);
+			entry = memo_lookup(args->memo, key, key_size, hash);
+			if (entry)
+				return apply_memo(path_p, st, entry, args);
+		}
+	}
+
+	for (stage = plan->stages; stage != plan->stages + plan->num_stages;
+	     stage++) {
+		if (stage->type == ACL_TYPE_ACCESS) {
 			xacl = &acl;
 			old_xacl = &old_acl;
-			acl_modified = 1;
-			if (cmd->c_tag == ACL_MASK)
-				acl_mask_provided = 1;
 		} else {
 			xacl = &default_acl;
 			old_xacl = &old_default_acl;
-			default_acl_modified = 1;
-			if (cmd->c_tag == ACL_MASK)
-				default_acl_mask_provided = 1;
 		}
 
-		RETRIEVE_ACL(cmd->c_type);
-
-		/* Check for `X', and replace with `x' as appropriate. */
-		if (perm & CMD_PERM_COND_EXECUTE) {
-			perm &= ~CMD_PERM_COND_EXECUTE;
-			if (S_ISDIR(st->st_mode) || has_execute_perms(*xacl))
-				perm |= CMD_PERM_EXECUTE;
-		}
+		RETRIEVE_ACL(stage->type);
 
-		switch(cmd->c_cmd) {
+		switch(stage->cmd) {
 			case CMD_ENTRY_REPLACE:
-				ent = find_entry(*xacl, cmd->c_tag, cmd->c_id);
-				if (!ent) {
-					if (acl_create_entry(xacl, &ent) != 0)
-						goto fail;
-					acl_set_tag_type(ent, cmd->c_tag);
-					if (cmd->c_id != ACL_UNDEFINED_ID)
-						acl_set_qualifier(ent,
-								  &cmd->c_id);
-				}
-				set_perm(ent, perm);
-				break;
-
-			case CMD_REMOVE_ENTRY:
-				ent = find_entry(*xacl, cmd->c_tag, cmd->c_id);
-				if (ent)
-					acl_delete_entry(*xacl, ent);
-				else
-					/* ignore */;
+				if (apply_edits(xacl, stage, st) != 0)
+					goto fail;
 				break;
 
 			case CMD_REMOVE_EXTENDED_ACL:
@@ -352,18 +1295,9 @@ do_set(
 				if (!*xacl)
 					goto fail;
 				break;
-
-			default:
-				errno = EINVAL;
-				goto fail;
 		}
-
-		error = seq_get_cmd(args->seq, SEQ_NEXT_CMD, &cmd);
 	}
 
-	if (error < 0)
-		goto fail;
-
 	/* Try to fill in missing entries */
 	if (default_acl && acl_entries(default_acl) != 0) {
 		xacl = &acl;
@@ -390,14 +1324,15 @@ do_set(
 	}
 
 	/* update mask entries and check if ACLs are valid */
-	if (acl && acl_modified) {
+	if (acl && plan->acl_modified) {
 		if (acl_equiv_mode(acl, NULL) != 0) {
-			if (!acl_mask_provided &&
+			if (!plan->acl_mask_provided &&
 			    !find_entry(acl, ACL_MASK, ACL_UNDEFINED_ID))
 				clone_entry(acl, ACL_GROUP_OBJ,
 				            &acl, ACL_MASK);
 			if (opt_recalculate != -1 &&
-			    (!acl_mask_provided || opt_recalculate == 1))
+			    (!plan->acl_mask_provided ||
+			     opt_recalculate == 1))
 				acl_calc_mask(&acl);
 		}
 
@@ -407,8 +1342,9 @@ do_set(
 		if (error > 0) {
 			acl_text = acl_to_any_text(acl, NULL, ',', 0);
 			fprintf(stderr, _("%s: %s: Malformed access ACL "
-				"`%s': %s at entry %d\n"), progname, path_p,
-				acl_text, acl_error(error), which_entry+1);
+				"`%s': %s at entry %d\n"), progname,
+				ERROR_NAME(args, path_p), acl_text,
+				acl_error(error), which_entry+1);
 			acl_free(acl_text);
 			errors++;
 			goto cleanup;
@@ -416,14 +1352,14 @@ do_set(
 	}
 
 	if (default_acl && acl_entries(default_acl) != 0 &&
-	    default_acl_modified) {
+	    plan->default_acl_modified) {
 		if (acl_equiv_mode(default_acl, NULL) != 0) {
-			if (!default_acl_mask_provided &&
+			if (!plan->default_acl_mask_provided &&
 			    !find_entry(default_acl,ACL_MASK,ACL_UNDEFINED_ID))
 				clone_entry(default_acl, ACL_GROUP_OBJ,
 				            &default_acl, ACL_MASK);
 			if (opt_recalculate != -1 &&
-			    (!default_acl_mask_provided ||
+			    (!plan->default_acl_mask_provided ||
 			     opt_recalculate == 1))
 				acl_calc_mask(&default_acl);
 		}
@@ -435,7 +1371,7 @@ do_set(
 			acl_text = acl_to_any_text(default_acl, NULL, ',', 0);
 			fprintf(stderr, _("%s: %s: Malformed default ACL "
 			                  "`%s': %s at entry %d\n"),
-				progname, path_p, acl_text,
+				progname, ERROR_NAME(args, path_p), acl_text,
 				acl_error(error), which_entry+1);
 			acl_free(acl_text);
 			errors++;
@@ -461,6 +1397,10 @@ do_set(
 		default_acl = NULL;
 	}
 
+	if (key_size)
+		memo_insert(args->memo, st, key, key_size, hash,
+			    acl, default_acl);
+
 	/* update the file system */
 	if (opt_test) {
 		print_test(stdout, path_p, st,
@@ -473,11 +1413,12 @@ do_set(
 
 		equiv_mode = acl_equiv_mode(acl, &mode);
 
-		if (acl_set_file(path_p, ACL_TYPE_ACCESS, acl) != 0) {
+		if (set_acl(path_p, args->fd, ACL_TYPE_ACCESS, acl) != 0) {
 			if (errno == ENOSYS || errno == ENOTSUP) {
 				if (equiv_mode != 0)
 					goto fail;
-				else if (chmod(path_p, mode) != 0)
+				else if (change_mode(path_p, args->fd,
+						     mode) != 0)
 					goto fail;
 			} else
 				goto fail;
@@ -487,19 +1428,21 @@ do_set(
 	if (default_acl) {
 		if (S_ISDIR(st->st_mode)) {
 			if (acl_entries(default_acl) == 0) {
-				if (acl_delete_def_file(path_p) != 0 &&
+				if (delete_default_acl(path_p,
+						       args->fd) != 0 &&
 				    errno != ENOSYS && errno != ENOTSUP)
 					goto fail;
 			} else {
-				if (acl_set_file(path_p, ACL_TYPE_DEFAULT,
-						 default_acl) != 0)
+				if (set_acl(path_p, args->fd,
+					    ACL_TYPE_DEFAULT,
+					    default_acl) != 0)
 					goto fail;
 			}
 		} else {
 			if (acl_entries(default_acl) != 0) {
 				fprintf(stderr, _("%s: %s: Only directories "
 						"can have default ACLs\n"),
-					progname, path_p);
+					progname, ERROR_NAME(args, path_p));
 				errors++;
 				goto cleanup;
 			}
@@ -520,7 +1463,8 @@ cleanup:
 	return errors;
 	
 fail:
-	fprintf(stderr, "%s: %s: %s\n", progname, path_p, strerror(errno));
+	fprintf(stderr, "%s: %s: %s\n", progname, ERROR_NAME(args, path_p),
+		strerror(errno));
 	errors++;
 	goto cleanup;
 }
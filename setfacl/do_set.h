@@ -24,13 +24,87 @@
 #define __DO_SET_H
 
 #include "sequence.h"
+#include "inode_set.h"
+
+/*
+ * A command sequence compiled for applying it to many files: the entry
+ * commands between barriers are merged into stages of edits sorted like
+ * the entries of an ACL, which are applied in a single pass.
+ */
+struct do_set_edit {
+	acl_tag_t tag;
+	id_t id;
+	cmd_tag_t cmd;		/* CMD_ENTRY_REPLACE or CMD_REMOVE_ENTRY */
+	mode_t perm;
+	size_t order;		/* position in the sequence */
+};
+
+struct do_set_stage {
+	cmd_tag_t cmd;		/* CMD_ENTRY_REPLACE for edits, or a barrier */
+	acl_type_t type;
+	struct do_set_edit *edits;
+	size_t num_edits;
+};
+
+struct do_set_plan {
+	struct do_set_stage *stages;
+	size_t num_stages;
+	int acl_modified, default_acl_modified;
+	int acl_mask_provided, default_acl_mask_provided;
+};
+
+extern struct do_set_plan *do_set_compile(seq_t seq);
+extern void do_set_free(struct do_set_plan *plan);
+
+/*
+ * The result of applying a plan only depends on the ACLs a file starts
+ * out with and on whether it is a directory. In a recursive walk, most
+ * files share one of a few such states: a memo table remembers the
+ * result for each state. A memo table may be shared between threads.
+ */
+struct do_set_memo;
+
+extern struct do_set_memo *do_set_memo_create(void);
+extern void do_set_memo_free(struct do_set_memo *memo);
+
+/*
+ * The ACLs of a reference file, as the extended attribute values to copy
+ * to other files. Without a default ACL, default_size is 0.
+ */
+struct do_set_reference {
+	void *acl_value;
+	size_t acl_size;
+	int equiv_mode;		/* the access ACL is equivalent to mode */
+	mode_t mode;
+	void *default_value;
+	size_t default_size;
+};
+
+extern struct do_set_reference *do_set_reference_read(const char *path_p);
+extern void do_set_reference_free(struct do_set_reference *ref);
+
+/*
+ * Minimizing access ACLs: the number of files whose ACL was or would be
+ * rewritten, and the number of attribute bytes that saves.
+ */
+struct do_set_minimize {
+	unsigned long files;
+	unsigned long long saved;
+};
 
 struct do_set_args {
-	seq_t seq;
+	struct do_set_plan *plan;
+	const struct do_set_reference *reference;  /* copied instead of plan */
+	struct do_set_minimize *minimize;  /* minimized instead of plan */
 	mode_t mode;
+	struct inode_set *links;  /* hard linked files already done */
+	struct do_set_memo *memo;  /* results by initial ACLs, or NULL */
+	int fd;  /* the open file, or -1 to use its path name */
+	const char *name;  /* the name to report errors for, or NULL */
 };
 
 extern int do_set(const char *path_p, const struct stat *stat_p, int flags,
 		  void *arg);
+extern void do_set_release(void);
 
 #endif  /* __DO_SET_H */
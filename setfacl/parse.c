@@ -26,8 +26,10 @@
 #include <errno.h>
 #include <limits.h>
 
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <pwd.h>
 #include <grp.h>
 #include "sys/acl.h"
@@ -75,10 +77,16 @@ delimiter:
 }
 
 
+/*
+	Returns the next token in a buffer which is reused by the next call,
+	or NULL if there is none.
+*/
 static char *
 get_token(
 	const char **text_p)
 {
+	static char *token_buf;
+	static size_t token_size;
 	char *token = NULL, *t;
 	const char *bp, *ep;
 
@@ -90,9 +98,9 @@ get_token(
 		ep++;
 	if (ep == bp)
 		goto after_token;
-	token = (char*)malloc(ep - bp + 1);
-	if (token == NULL)
+	if (high_water_alloc((void **)&token_buf, &token_size, ep - bp + 1))
 		goto after_token;
+	token = token_buf;
 	memcpy(token, bp, ep - bp);
 
 	/* Trim trailing whitespace */
@@ -132,18 +140,63 @@ get_id(
 }
 
 
+/*
+	Backups name the same few owners and groups over and over again:
+	remember the last name that was looked up.
+*/
+struct name_cache {
+	char *name;
+	size_t size;
+	id_t id;
+};
+
+static int
+name_cache_find(
+	const struct name_cache *cache,
+	const char *token,
+	id_t *id_p)
+{
+	if (!cache->name || strcmp(cache->name, token) != 0)
+		return -1;
+	*id_p = cache->id;
+	return 0;
+}
+
+static void
+name_cache_add(
+	struct name_cache *cache,
+	const char *token,
+	id_t id)
+{
+	size_t size = strlen(token) + 1;
+
+	if (high_water_alloc((void **)&cache->name, &cache->size, size)) {
+		free(cache->name);
+		cache->name = NULL;
+		cache->size = 0;
+		return;
+	}
+	memcpy(cache->name, token, size);
+	cache->id = id;
+}
+
+
 static int
 get_uid(
 	const char *token,
 	uid_t *uid_p)
 {
+	static struct name_cache cache;
 	struct passwd *passwd;
 
 	if (get_id(token, (id_t *)uid_p) == 0)
 		goto accept;
+	if (name_cache_find(&cache, token, (id_t *)uid_p) == 0)
+		goto accept;
 	passwd = getpwnam(token);
 	if (passwd) {
 		*uid_p = passwd->pw_uid;
+		name_cache_add(&cache, token, *uid_p);
 		goto accept;
 	}
 	return -1;
@@ -158,13 +211,17 @@ get_gid(
 	const char *token,
 	gid_t *gid_p)
 {
+	static struct name_cache cache;
 	struct group *group;
 
 	if (get_id(token, (id_t *)gid_p) == 0)
 		goto accept;
+	if (name_cache_find(&cache, token, (id_t *)gid_p) == 0)
+		goto accept;
 	group = getgrnam(token);
 	if (group) {
 		*gid_p = group->gr_gid;
+		name_cache_add(&cache, token, *gid_p);
 		goto accept;
 	}
 	return -1;
@@ -175,24 +232,26 @@ accept:
 
 
 /*
-	Parses the next acl entry in text_p.
+	Parses the next acl entry in text_p, and appends it to seq.
 
 	Returns:
 		-1 on error, 0 on success.
 */
 
-cmd_t
+int
 parse_acl_cmd(
+	seq_t seq,
 	const char **text_p,
 	int seq_cmd,
 	int parse_mode)
 {
-	cmd_t cmd = cmd_init();
+	cmd_t cmd = seq_new_cmd(seq);
 	char *str;
 	const char *backup;
 	int error, perm_chars;
 	if (!cmd)
-		return NULL;
+		return -1;
+	seq_append(seq, cmd);
 
 	cmd->c_cmd = seq_cmd;
 	if (parse_mode & SEQ_PROMOTE_ACL)
@@ -227,7 +286,6 @@ user_entry:
 			if (str) {
 				cmd->c_tag = ACL_USER;
 				error = get_uid(unquote(str), &cmd->c_id);
-				free(str);
 				if (error) {
 					*text_p = backup;
 					goto fail;
@@ -246,7 +304,6 @@ user_entry:
 			if (str) {
 				cmd->c_tag = ACL_GROUP;
 				error = get_gid(unquote(str), &cmd->c_id); 
-				free(str);
 				if (error) {
 					*text_p = backup;
 					goto fail;
@@ -285,12 +342,12 @@ user_entry:
 	SKIP_WS(*text_p);
 	if (**text_p == ',' || **text_p == '\0') {
 		if (parse_mode & SEQ_PARSE_NO_PERM)
-			return cmd;
+			return 0;
 		else
 			goto fail;
 	}
 	if (!(parse_mode & SEQ_PARSE_WITH_PERM))
-		return cmd;
+		return 0;
 
 	/* parse permissions */
 	SKIP_WS(*text_p);
@@ -302,7 +359,7 @@ user_entry:
 			cmd->c_perm = (*(*text_p)++ - '0');
 		}
 
-		return cmd;
+		return 0;
 	}
 
 	for (perm_chars=0; perm_chars<3; perm_chars++, (*text_p)++) {
@@ -340,16 +397,17 @@ user_entry:
 			default:
 				if (perm_chars == 0)
 					goto fail;
-				return cmd;
+				return 0;
 		}
 	}
 	if (perm_chars != 3)
 		goto fail;
-	return cmd;
+	return 0;
 
 fail:
-	cmd_free(cmd);
-	return NULL;
+	seq_delete_cmd(seq, cmd);
+	errno = EINVAL;
+	return -1;
 }
 
 
@@ -368,21 +426,13 @@ parse_acl_seq(
 	int parse_mode)
 {
 	const char *initial_text_p = text_p;
-	cmd_t cmd;
 
 	if (which)
 		*which = -1;
 
 	while (*text_p != '\0') {
-		cmd = parse_acl_cmd(&text_p, seq_cmd, parse_mode);
-		if (cmd == NULL) {
-			errno = EINVAL;
-			goto fail;
-		}
-		if (seq_append(seq, cmd) != 0) {
-			cmd_free(cmd);
+		if (parse_acl_cmd(seq, &text_p, seq_cmd, parse_mode) != 0)
 			goto fail;
-		}
 		SKIP_WS(text_p);
 		if (*text_p != ',')
 			break;
@@ -404,22 +454,226 @@ fail:
 
 
 
+/* Size of the buffer for reading input which cannot be mapped */
+#define INPUT_BUFFER_SIZE	(256 * 1024)
+
+struct acl_input {
+	int fd;
+	int error;		/* errno of a read error, or 0 */
+	int unread;		/* return the current line again */
+
+	/* Regular files are mapped into memory. */
+	char *map;
+	size_t map_size, map_pos;
+
+	/* Other input is read in large chunks. */
+	char *buf;
+	size_t buf_size, buf_start, buf_end;
+	int eof;
+
+	char *line;		/* the current line */
+	char *line_buf;		/* copy of a mapped line */
+	size_t line_size;
+
+	char *text;		/* see read_acl_text() */
+	size_t text_size;
+};
+
+
+/*
+	Open the input of a FILE for reading lines. Regular files are
+	mapped into memory starting at the current offset; other files
+	are read in large chunks.
+*/
+struct acl_input *
+acl_input_open(
+	FILE *file)
+{
+	struct acl_input *input;
+	struct stat st;
+	off_t offset;
+
+	input = calloc(1, sizeof(*input));
+	if (!input)
+		return NULL;
+	input->fd = fileno(file);
+	if (fstat(input->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    (offset = lseek(input->fd, 0, SEEK_CUR)) != -1 &&
+	    offset < st.st_size && (off_t)(size_t)st.st_size == st.st_size) {
+		input->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				  input->fd, 0);
+		if (input->map != MAP_FAILED) {
+			input->map_size = st.st_size;
+			input->map_pos = offset;
+			return input;
+		}
+		input->map = NULL;
+	}
+	return input;
+}
+
+
+/*
+	Close the input. The offset of a mapped file is left after the
+	lines that were read.
+*/
+void
+acl_input_close(
+	struct acl_input *input)
+{
+	int saved_errno = errno;
+
+	if (!input)
+		return;
+	if (input->map && input->fd != -1) {
+		lseek(input->fd, input->map_pos, SEEK_SET);
+		munmap(input->map, input->map_size);
+	}
+	free(input->buf);
+	free(input->line_buf);
+	free(input->text);
+	free(input);
+	errno = saved_errno;
+}
+
+
+/*
+	Open a string of SIZE bytes for reading lines. The string must
+	remain valid until the input is closed.
+*/
+struct acl_input *
+acl_input_text(
+	const char *text,
+	size_t size)
+{
+	struct acl_input *input;
+
+	input = calloc(1, sizeof(*input));
+	if (!input)
+		return NULL;
+	input->fd = -1;
+	input->map = (char *)(size ? text : "");
+	input->map_size = size;
+	return input;
+}
+
+
+/*
+	Return the next line without the newline, or NULL at the end of the
+	input or after an error. Lines can be of any length. The line may be
+	modified, and remains valid until the next call.
+*/
+static char *
+acl_input_line(
+	struct acl_input *input)
+{
+	char *nl;
+	size_t len;
+	ssize_t size;
+
+	if (input->unread) {
+		input->unread = 0;
+		return input->line;
+	}
+	input->line = NULL;
+
+	if (input->map) {
+		char *start = input->map + input->map_pos;
+
+		len = input->map_size - input->map_pos;
+		if (len == 0)
+			return NULL;
+		nl = memchr(start, '\n', len);
+		if (nl)
+			len = nl - start;
+		input->map_pos += len + (nl != NULL);
+		if (high_water_alloc((void **)&input->line_buf,
+				     &input->line_size, len + 1)) {
+			input->error = errno;
+			return NULL;
+		}
+		memcpy(input->line_buf, start, len);
+		input->line_buf[len] = '\0';
+		input->line = input->line_buf;
+		return input->line;
+	}
+
+	for(;;) {
+		len = input->buf_end - input->buf_start;
+		/* The buffer is only allocated once something is read. */
+		nl = len ? memchr(input->buf + input->buf_start, '\n', len) :
+			   NULL;
+		if (nl || (input->eof && len)) {
+			input->line = input->buf + input->buf_start;
+			if (nl) {
+				len = nl - input->line;
+				input->buf_start += len + 1;
+			} else
+				input->buf_start = input->buf_end;
+			/* There is always room for the terminating null. */
+			input->line[len] = '\0';
+			return input->line;
+		}
+		if (input->eof)
+			return NULL;
+
+		/* Make room for more input, keeping the partial line. */
+		if (input->buf_start) {
+			memmove(input->buf, input->buf + input->buf_start, len);
+			input->buf_start = 0;
+			input->buf_end = len;
+		}
+		if (input->buf_size - input->buf_end <= 1) {
+			size_t size = input->buf_size ?
+				      2 * input->buf_size : INPUT_BUFFER_SIZE;
+			char *buf = realloc(input->buf, size);
+
+			if (!buf) {
+				input->error = errno;
+				return NULL;
+			}
+			input->buf = buf;
+			input->buf_size = size;
+		}
+		size = read(input->fd, input->buf + input->buf_end,
+			    input->buf_size - input->buf_end - 1);
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+			input->error = errno;
+			return NULL;
+		}
+		if (size == 0)
+			input->eof = 1;
+		input->buf_end += size;
+	}
+}
+
+
+/*
+	Return the current line again from the next acl_input_line().
+*/
+static void
+acl_input_unread(
+	struct acl_input *input)
+{
+	if (input->line)
+		input->unread = 1;
+}
+
+
 int
 read_acl_comments(
-	FILE *file,
+	struct acl_input *input,
 	int *line,
 	char **path_p,
+	int *path_line,
 	uid_t *uid_p,
 	gid_t *gid_p,
-	mode_t *flags)
+	mode_t *flags,
+	int *same_as)
 {
-	int c;
-	/*
-	  Max PATH_MAX bytes even for UTF-8 path names and additional 9
-	  bytes for "# file: ". Not a good solution but for now it is the
-	  best I can do without too much impact on the code. [tw]
-	*/
-	char linebuf[(4*PATH_MAX)+9];
+	char *linebuf;
 	char *cp;
 	char *p;
 	int comments_read = 0;
@@ -432,25 +686,26 @@ read_acl_comments(
 		*gid_p = ACL_UNDEFINED_ID;
 	if (flags)
 		*flags = 0;
+	if (same_as)
+		*same_as = 0;
 
 	for(;;) {
-		c = fgetc(file);
-		if (c == EOF)
+		linebuf = acl_input_line(input);
+		if (linebuf == NULL)
 			break;
-		if (c==' ' || c=='\t' || c=='\r' || c=='\n') {
-			if (c=='\n')
+		cp = linebuf;
+		SKIP_WS(cp);
+		if (*cp == '\0') {
+			if (line)
 				(*line)++;
 			continue;
 		}
-		if (c != '#') {
-			ungetc(c, file);
+		if (*cp != '#') {
+			acl_input_unread(input);
 			break;
 		}
 		if (line)
 			(*line)++;
-
-		if (fgets(linebuf, sizeof(linebuf), file) == NULL)
-			break;
 		
 		comments_read = 1;
 
@@ -461,7 +716,7 @@ read_acl_comments(
 			*p = '\0';
 		}
 		
-		cp = linebuf;
+		cp++;
 		SKIP_WS(cp);
 		if (strncmp(cp, "file:", 5) == 0) {
 			cp += 5;
@@ -476,6 +731,8 @@ read_acl_comments(
 					return -1;
 				strcpy(*path_p, cp);
 			}
+			if (path_line && line)
+				*path_line = *line;
 		} else if (strncmp(cp, "owner:", 6) == 0) {
 			cp += 6;
 			SKIP_WS(cp);
@@ -519,10 +776,20 @@ read_acl_comments(
 
 			if (flags)
 				*flags = f;
+		} else if (strncmp(cp, "same as:", 8) == 0) {
+			/*
+			 * A further link to a file listed before; this
+			 * ends the entry.
+			 */
+			if (same_as)
+				*same_as = 1;
+			break;
 		}
 	}
-	if (ferror(file))
+	if (input->error) {
+		errno = input->error;
 		return -1;
+	}
 	return comments_read;
 fail:
 	if (path_p && *path_p) {
@@ -535,22 +802,22 @@ fail:
 
 int
 read_acl_seq(
-	FILE *file,
+	struct acl_input *input,
 	seq_t seq,
 	int seq_cmd,
 	int parse_mode,
 	int *line,
 	int *which)
 {
-	char linebuf[1024];
-	const char *cp;
-	cmd_t cmd;
+	char *linebuf = NULL;
+	const char *cp = NULL;
 
 	if (which)
 		*which = -1;
 
 	for(;;) {
-		if (fgets(linebuf, sizeof(linebuf), file) == NULL)
+		linebuf = acl_input_line(input);
+		if (linebuf == NULL)
 			break;
 		if (line)
 			(*line)++;
@@ -565,15 +832,8 @@ read_acl_seq(
 			continue;
 		}
 
-		cmd = parse_acl_cmd(&cp, seq_cmd, parse_mode);
-		if (cmd == NULL) {
-			errno = EINVAL;
-			goto fail;
-		}
-		if (seq_append(seq, cmd) != 0) {
-			cmd_free(cmd);
+		if (parse_acl_cmd(seq, &cp, seq_cmd, parse_mode) != 0)
 			goto fail;
-		}
 
 		SKIP_WS(cp);
 		if (*cp != '\0' && *cp != '#') {
@@ -582,13 +842,62 @@ read_acl_seq(
 		}
 	}
 
-	if (ferror(file))
+	if (input->error) {
+		errno = input->error;
 		goto fail;
+	}
 	return 0;
 
 fail:
-	if (which)
+	if (which && linebuf)
 		*which = (cp - linebuf);
 	return -1;
 }
 
+
+/*
+	Read the lines of an ACL up to the next empty line without parsing
+	them, for parsing them later with acl_input_text() and read_acl_seq().
+	The lines are separated by newlines in *text_p, which remains valid
+	until the next call. Returns the number of lines read including the
+	empty line, or -1 on error.
+*/
+int
+read_acl_text(
+	struct acl_input *input,
+	const char **text_p,
+	size_t *size_p)
+{
+	size_t size = 0, len;
+	char *linebuf;
+	const char *cp;
+	int lines = 0;
+
+	for(;;) {
+		linebuf = acl_input_line(input);
+		if (linebuf == NULL)
+			break;
+		lines++;
+
+		cp = linebuf;
+		SKIP_WS(cp);
+		if (*cp == '\0')
+			break;
+
+		len = strlen(linebuf);
+		if (high_water_alloc((void **)&input->text, &input->text_size,
+				     size + len + 2))
+			return -1;
+		memcpy(input->text + size, linebuf, len);
+		size += len;
+		input->text[size++] = '\n';
+	}
+
+	if (input->error) {
+		errno = input->error;
+		return -1;
+	}
+	*text_p = input->text;
+	*size_p = size;
+	return lines;
+}
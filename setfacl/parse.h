@@ -24,6 +24,7 @@
 #define __PARSE_H
 
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include "sequence.h"
@@ -46,8 +47,9 @@ extern "C" {
 #define SEQ_PROMOTE_ACL		(0x0040)	/* promote from acl
                                                    to default acl */
 
-cmd_t
+int
 parse_acl_cmd(
+	seq_t seq,
 	const char **text_p,
 	int seq_cmd,
 	int parse_mode);
@@ -58,22 +60,44 @@ parse_acl_seq(
 	int *which,
 	int seq_cmd,
 	int parse_mode);
+
+/* reading ACLs from files */
+
+struct acl_input;
+
+struct acl_input *
+acl_input_open(
+	FILE *file);
+struct acl_input *
+acl_input_text(
+	const char *text,
+	size_t size);
+void
+acl_input_close(
+	struct acl_input *input);
 int
 read_acl_comments(
-	FILE *file,
+	struct acl_input *input,
 	int *line,
 	char **path_p,
+	int *path_line,
 	uid_t *uid_p,
 	gid_t *gid_p,
-	mode_t *flags);
+	mode_t *flags,
+	int *same_as);
 int
 read_acl_seq(
-	FILE *file,
+	struct acl_input *input,
 	seq_t seq,
 	int seq_cmd,
 	int parse_mode,
 	int *line,
 	int *which);
+int
+read_acl_text(
+	struct acl_input *input,
+	const char **text_p,
+	size_t *size_p);
 
 
 #ifdef __cplusplus
@@ -49,6 +49,7 @@ seq_init(
 	if (seq == NULL)
 		return NULL;
 	seq->s_first = seq->s_last = NULL;
+	seq->s_free = NULL;
 	return seq;
 }
 
@@ -57,17 +58,52 @@ int
 seq_free(
 	seq_t seq)
 {
-	cmd_t cmd = seq->s_first;
-	while (cmd) {
-		seq->s_first = seq->s_first->c_next;
+	cmd_t cmd;
+
+	seq_reset(seq);
+	while ((cmd = seq->s_free)) {
+		seq->s_free = cmd->c_next;
 		cmd_free(cmd);
-		cmd = seq->s_first;
 	}
 	free(seq);
 	return 0;
 }
 
 
+/*
+	Remove all commands from a sequence. The commands are kept for
+	reuse by seq_new_cmd(), so a sequence that is reset for each of
+	many records does not allocate memory for each record.
+*/
+void
+seq_reset(
+	seq_t seq)
+{
+	if (seq->s_first) {
+		seq->s_last->c_next = seq->s_free;
+		seq->s_free = seq->s_first;
+	}
+	seq->s_first = seq->s_last = NULL;
+}
+
+
+/*
+	Allocate a command for appending to a sequence.
+*/
+cmd_t
+seq_new_cmd(
+	seq_t seq)
+{
+	cmd_t cmd = seq->s_free;
+
+	if (cmd) {
+		seq->s_free = cmd->c_next;
+		return cmd;
+	}
+	return cmd_init();
+}
+
+
 int
 seq_empty(
 	seq_t seq)
@@ -98,16 +134,12 @@ seq_append_cmd(
 	cmd_tag_t cmd,
 	acl_type_t type)
 {
-	cmd_t cmd_d = cmd_init();
+	cmd_t cmd_d = seq_new_cmd(seq);
 	if (cmd_d == NULL)
 		return -1;
 	cmd_d->c_cmd = cmd;
 	cmd_d->c_type = type;
-	if (seq_append(seq, cmd_d) != 0) {
-		cmd_free(cmd_d);
-		return -1;
-	}
-	return 0;
+	return seq_append(seq, cmd_d);
 }
 
 
@@ -146,7 +178,8 @@ seq_delete_cmd(
 
 	if (cmd == seq->s_first) {
 		seq->s_first = seq->s_first->c_next;
-		cmd_free(cmd);
+		cmd->c_next = seq->s_free;
+		seq->s_free = cmd;
 		return 0;
 	}
 	while (prev != NULL && prev->c_next != cmd)
@@ -156,7 +189,8 @@ seq_delete_cmd(
 	if (cmd == seq->s_last)
 		seq->s_last = prev;
 	prev->c_next = cmd->c_next;
-	cmd_free(cmd);
+	cmd->c_next = seq->s_free;
+	seq->s_free = cmd;
 	return 0;
 }
 
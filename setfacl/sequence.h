@@ -49,6 +49,7 @@ typedef struct cmd_obj *cmd_t;
 struct seq_obj {
 	cmd_t			s_first;
 	cmd_t			s_last;
+	cmd_t			s_free;		/* commands for reuse */
 };
 
 typedef struct seq_obj *seq_t;
@@ -83,6 +84,12 @@ seq_init(
 int
 seq_free(
 	seq_t seq);
+void
+seq_reset(
+	seq_t seq);
+cmd_t
+seq_new_cmd(
+	seq_t seq);
 int
 seq_empty(
 	seq_t seq);
@@ -21,27 +21,31 @@
 */
 
 #include <limits.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <libgen.h>
 #include <getopt.h>
 #include <locale.h>
+#include <pthread.h>
 #include "config.h"
 #include "sequence.h"
 #include "parse.h"
 #include "do_set.h"
 #include "walk_tree.h"
 #include "misc.h"
+#include "serve.h"
 
 #define POSIXLY_CORRECT_STR "POSIXLY_CORRECT"
 
 /* '-' stands for `process non-option arguments in loop' */
 #if !POSIXLY_CORRECT
-#  define CMD_LINE_OPTIONS "-:bkndvhm:M:x:X:RLP"
+#  define CMD_LINE_OPTIONS "-:bkndvhm:M:x:X:RLP0"
 #  define CMD_LINE_SPEC "[-bkndRLP] { -m|-M|-x|-X ... } file ..."
 #endif
 #define POSIXLY_CMD_LINE_OPTIONS "-:bkndvhm:M:x:X:"
@@ -51,13 +55,20 @@ struct option long_options[] = {
 #if !POSIXLY_CORRECT
 	{ "set",		1, 0, 's' },
 	{ "set-file",		1, 0, 'S' },
+	{ "reference",		1, 0, 'E' },
+	{ "minimize",		0, 0, 'Z' },
 
 	{ "mask",		0, 0, 'r' },
 	{ "recursive",		0, 0, 'R' },
 	{ "logical",		0, 0, 'L' },
 	{ "physical",		0, 0, 'P' },
 	{ "restore",		1, 0, 'B' },
+	{ "jobs",		1, 0, 'j' },
 	{ "test",		0, 0, 't' },
+	{ "files-from",		1, 0, 'F' },
+	{ "null",		0, 0, '0' },
+	{ "serve",		2, 0, 'V' },
+	WALK_TREE_LONG_OPTIONS,
 #endif
 	{ "modify",		1, 0, 'm' },
 	{ "modify-file",	1, 0, 'M' },
@@ -81,6 +92,10 @@ int opt_recalculate;  /* recalculate mask entry (0=default, 1=yes, -1=no) */
 int opt_promote;  /* promote access ACL to default ACL */
 int opt_test;  /* do not write to the file system.
                       Print what would happen instead. */
+int opt_jobs = 1;  /* number of threads for restoring and file lists */
+int opt_null;  /* names of files are separated by null characters */
+struct do_set_reference *reference;  /* ACLs to copy (--reference) */
+int opt_minimize;  /* minimize access ACLs */
 #if POSIXLY_CORRECT
 const int posixly_correct = 1;  /* Posix compatible behavior! */
 #else
@@ -115,35 +130,824 @@ has_any_of_type(
 	
 
 #if !POSIXLY_CORRECT
+/*
+ * Messages from restore worker threads share the buffer of quote(), so
+ * they are printed one at a time.
+ */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of parent directories each thread keeps open */
+#define RESTORE_DIRS		8
+
+/*
+ * Consecutive records of a backup are mostly in the same few directories.
+ * Files are looked up relative to their open parent directory instead of
+ * walking down their whole path for each operation.
+ */
+struct restore_dir {
+	char *path;
+	size_t len;
+	int fd;
+};
+
+static __thread struct restore_dir restore_dirs[RESTORE_DIRS];
+static __thread unsigned int restore_dirs_next;
+
+/*
+ * Return a file descriptor of the parent directory of PATH_P, and the
+ * name of the file relative to it in *NAME_P. Returns AT_FDCWD and the
+ * path itself if there is no parent directory to open.
+ */
+static int
+restore_dirfd(
+	const char *path_p,
+	const char **name_p)
+{
+	const char *slash = strrchr(path_p, '/');
+	struct restore_dir *dir;
+	size_t len;
+	char *path;
+	int n, fd;
+
+	*name_p = path_p;
+	if (!slash || !slash[1])
+		return AT_FDCWD;
+	len = slash - path_p;
+	if (len == 0)
+		len = 1;  /* `/' */
+	for (n = 0; n < RESTORE_DIRS; n++) {
+		dir = &restore_dirs[n];
+		if (dir->path && dir->len == len &&
+		    memcmp(dir->path, path_p, len) == 0)
+			goto found;
+	}
+
+	path = malloc(len + 1);
+	if (!path)
+		return AT_FDCWD;
+	memcpy(path, path_p, len);
+	path[len] = '\0';
+#ifdef O_PATH
+	fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+	if (fd == -1) {
+		free(path);
+		return AT_FDCWD;
+	}
+	dir = &restore_dirs[restore_dirs_next++ % RESTORE_DIRS];
+	if (dir->path) {
+		close(dir->fd);
+		free(dir->path);
+	}
+	dir->path = path;
+	dir->len = len;
+	dir->fd = fd;
+
+found:
+	*name_p = slash + 1;
+	return dir->fd;
+}
+
+/* Close the parent directories of the calling thread. */
+static void
+restore_dirs_release(void)
+{
+	int n;
+
+	for (n = 0; n < RESTORE_DIRS; n++) {
+		if (restore_dirs[n].path) {
+			close(restore_dirs[n].fd);
+			free(restore_dirs[n].path);
+			restore_dirs[n].path = NULL;
+		}
+	}
+}
+
+/*
+ * Open a regular file or directory so that its ACLs, owner and mode can
+ * be changed through the file descriptor, and update *ST from it. Other
+ * kinds of files are not opened, as opening them may have side effects.
+ */
+static int
+restore_open(
+	int dirfd,
+	const char *name,
+	struct stat *st)
+{
+	int fd;
+
+	if (S_ISREG(st->st_mode))
+		fd = openat(dirfd, name, O_RDONLY | O_NONBLOCK | O_NOCTTY |
+					 O_CLOEXEC);
+	else if (S_ISDIR(st->st_mode))
+		fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	else
+		return -1;
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, st) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Restore the ACLs, owner, group and flags of one file from a record of
+ * a permission backup. Errors name the line of the record if LINE is not
+ * zero, as they are reported out of order with several jobs.
+ */
+static int
+restore_file(
+	const char *path_p,
+	int line,
+	uid_t uid,
+	gid_t gid,
+	mode_t flags,
+	struct do_set_plan *plan,
+	struct do_set_memo *memo)
+{
+	struct do_set_args args = { };
+	struct stat st;
+	const char *name, *error_name = path_p;
+	char *label = NULL;
+	mode_t mask;
+	int chmod_required = 0;
+	int dirfd, error, status = 0;
+
+	if (line && asprintf(&label, "%s (line %d)", path_p, line) < 0)
+		label = NULL;
+	if (label)
+		error_name = args.name = label;
+
+	memset(&st, 0, sizeof(st));
+	dirfd = restore_dirfd(path_p, &name);
+	error = fstatat(dirfd, name, &st, 0);
+	if (opt_test && error != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname,
+			xquote(error_name, "\n\r"), strerror(errno));
+		status = 1;
+	}
+
+	args.plan = plan;
+	args.memo = memo;
+	args.mode = 0;
+	args.fd = -1;
+	if (error == 0)
+		args.fd = restore_open(dirfd, name, &st);
+	error = do_set(path_p, &st, 0, &args);
+	if (error != 0) {
+		status = 1;
+		goto out;
+	}
+
+	if (uid != ACL_UNDEFINED_ID && uid != st.st_uid)
+		st.st_uid = uid;
+	else
+		st.st_uid = -1;
+	if (gid != ACL_UNDEFINED_ID && gid != st.st_gid)
+		st.st_gid = gid;
+	else
+		st.st_gid = -1;
+	if (!opt_test &&
+	    (st.st_uid != -1 || st.st_gid != -1)) {
+		if (args.fd != -1)
+			error = fchown(args.fd, st.st_uid, st.st_gid);
+		else
+			error = fchownat(dirfd, name, st.st_uid, st.st_gid, 0);
+		if (error != 0) {
+			pthread_mutex_lock(&output_lock);
+			fprintf(stderr, _("%s: %s: Cannot change "
+					  "owner/group: %s\n"),
+				progname, xquote(error_name, "\n\r"),
+				strerror(errno));
+			pthread_mutex_unlock(&output_lock);
+			status = 1;
+		}
+
+		/* chown() clears setuid/setgid so force a chmod if
+		 * S_ISUID/S_ISGID was expected */
+		if ((st.st_mode & flags) & (S_ISUID | S_ISGID))
+			chmod_required = 1;
+	}
+
+	mask = S_ISUID | S_ISGID | S_ISVTX;
+	if (chmod_required || ((st.st_mode & mask) != (flags & mask))) {
+		if (!args.mode)
+			args.mode = st.st_mode;
+		args.mode &= (S_IRWXU | S_IRWXG | S_IRWXO);
+		if (args.fd != -1)
+			error = fchmod(args.fd, flags | args.mode);
+		else
+			error = fchmodat(dirfd, name, flags | args.mode, 0);
+		if (error != 0) {
+			pthread_mutex_lock(&output_lock);
+			fprintf(stderr, _("%s: %s: Cannot change "
+					  "mode: %s\n"),
+				progname, xquote(error_name, "\n\r"),
+				strerror(errno));
+			pthread_mutex_unlock(&output_lock);
+			status = 1;
+		}
+	}
+
+out:
+	if (args.fd != -1)
+		close(args.fd);
+	free(label);
+	return status;
+}
+
+
+/* Number of records read ahead of the worker threads, and hash buckets */
+#define RESTORE_QUEUE_SIZE	1024
+
+/*
+ * A record of a permission backup waiting to be restored. A record waits
+ * until the records before it for the same file, for one of the
+ * directories above it, and for the files below it have been restored.
+ * It is on the waiting list of the closest record for the same file or a
+ * directory above it. Records for files below it are rare, and are
+ * waited for through restore_wait nodes.
+ */
+struct restore_wait {
+	struct restore_wait *next;
+	struct restore_record *rec;
+};
+
+struct restore_record {
+	struct restore_record *next;		/* in a queue */
+	struct restore_record *hash_next;
+	struct restore_record *waiting, **waiting_tail;
+	struct restore_wait *waiters;		/* for the files below */
+	unsigned int blocked;			/* records waited for */
+	char *path_p;
+	int line;
+	char *key;				/* normalized path */
+	unsigned int hash;
+	uid_t uid;
+	gid_t gid;
+	mode_t flags;
+	struct do_set_plan *plan;
+	struct do_set_memo *memo;
+	int own_plan;				/* or it is cached */
+};
+
+struct restore_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t ready_cond, room_cond;
+	struct restore_record *ready, **ready_tail;
+	struct restore_record *latest[RESTORE_QUEUE_SIZE];  /* by key */
+	unsigned int below[RESTORE_QUEUE_SIZE];  /* records by directory hash */
+	size_t in_flight;
+	int done;
+	int status;
+	pthread_t *threads;
+	int num_threads;
+};
+
+/*
+ * Normalize a path name so that equal files have equal names: remove
+ * leading `./', repeated slashes and trailing slashes.
+ */
+static char *
+restore_key(
+	const char *path_p)
+{
+	char *key, *k;
+
+	while (path_p[0] == '.' && path_p[1] == '/')
+		for (path_p++; *path_p == '/'; path_p++)
+			;
+	key = malloc(strlen(path_p) + 1);
+	if (!key)
+		return NULL;
+	for (k = key; *path_p; path_p++) {
+		if (*path_p == '/' && k != key && k[-1] == '/')
+			continue;
+		*k++ = *path_p;
+	}
+	while (k > key + 1 && k[-1] == '/')
+		k--;
+	if (k == key)
+		*k++ = '.';
+	*k = '\0';
+	return key;
+}
+
+static unsigned int
+restore_hash(
+	const char *key,
+	size_t len)
+{
+	unsigned int hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static struct restore_record **
+restore_find(
+	struct restore_queue *queue,
+	const char *key,
+	size_t len,
+	unsigned int hash)
+{
+	struct restore_record **pos;
+
+	for (pos = &queue->latest[hash % RESTORE_QUEUE_SIZE]; *pos;
+	     pos = &(*pos)->hash_next)
+		if ((*pos)->hash == hash && strncmp((*pos)->key, key, len) == 0 &&
+		    (*pos)->key[len] == '\0')
+			break;
+	return pos;
+}
+
+/*
+ * Find the latest record in flight for the file itself or for the
+ * closest directory above it.
+ */
+static struct restore_record *
+restore_depends(
+	struct restore_queue *queue,
+	const char *key)
+{
+	size_t len = strlen(key);
+	struct restore_record *rec;
+
+	for(;;) {
+		rec = *restore_find(queue, key, len, restore_hash(key, len));
+		if (rec)
+			return rec;
+		if (len == 1 && key[0] == '/')
+			return NULL;
+		while (len > 0 && key[len - 1] != '/')
+			len--;
+		if (len == 0) {
+			/* Relative names are below the current directory. */
+			if (strcmp(key, ".") == 0)
+				return NULL;
+			return *restore_find(queue, ".", 1,
+					     restore_hash(".", 1));
+		}
+		if (len > 1)
+			len--;  /* keep the slash of `/' */
+	}
+}
+
+/*
+ * Count a record in flight in the buckets of the directories above it, or
+ * uncount it when DELTA is -1. A directory without records below it in its
+ * bucket has no records below it in flight.
+ */
+static void
+restore_count_below(
+	struct restore_queue *queue,
+	const char *key,
+	int delta)
+{
+	size_t len = strlen(key);
+
+	if (strcmp(key, ".") == 0)
+		return;
+	while (len > 1 || (len == 1 && key[0] != '/')) {
+		while (len > 0 && key[len - 1] != '/')
+			len--;
+		if (len == 0) {
+			queue->below[restore_hash(".", 1) %
+				     RESTORE_QUEUE_SIZE] += delta;
+			break;
+		}
+		if (len > 1)
+			len--;  /* keep the slash of `/' */
+		queue->below[restore_hash(key, len) % RESTORE_QUEUE_SIZE] +=
+			delta;
+	}
+}
+
+static int
+restore_is_below(
+	const char *key,
+	const char *dir)
+{
+	size_t len = strlen(dir);
+
+	if (strcmp(dir, ".") == 0)
+		return key[0] != '/' && strcmp(key, ".") != 0;
+	if (strcmp(dir, "/") == 0)
+		return key[0] == '/' && key[1] != '\0';
+	return strncmp(key, dir, len) == 0 && key[len] == '/';
+}
+
+/*
+ * Make a record wait for the latest records in flight for the files below
+ * it; the records before them are restored before them. Returns the number
+ * of records to wait for, or -1 if out of memory.
+ */
+static int
+restore_wait_below(
+	struct restore_queue *queue,
+	struct restore_record *rec)
+{
+	struct restore_wait *waits = NULL, *wait;
+	struct restore_record *other;
+	int count = 0;
+	size_t n;
+
+	if (!queue->below[rec->hash % RESTORE_QUEUE_SIZE])
+		return 0;
+	for (n = 0; n < RESTORE_QUEUE_SIZE; n++) {
+		for (other = queue->latest[n]; other;
+		     other = other->hash_next) {
+			if (!restore_is_below(other->key, rec->key))
+				continue;
+			wait = malloc(sizeof(*wait));
+			if (!wait)
+				goto fail;
+			wait->rec = other;
+			wait->next = waits;
+			waits = wait;
+			count++;
+		}
+	}
+	while ((wait = waits)) {
+		waits = wait->next;
+		other = wait->rec;
+		wait->rec = rec;
+		wait->next = other->waiters;
+		other->waiters = wait;
+	}
+	return count;
+
+fail:
+	while ((wait = waits)) {
+		waits = wait->next;
+		free(wait);
+	}
+	return -1;
+}
+
+/* A record waited for has been restored. */
+static void
+restore_unblock(
+	struct restore_queue *queue,
+	struct restore_record *rec)
+{
+	if (--rec->blocked)
+		return;
+	rec->next = NULL;
+	*queue->ready_tail = rec;
+	queue->ready_tail = &rec->next;
+}
+
+static void
+restore_free_record(
+	struct restore_record *rec)
+{
+	free(rec->path_p);
+	free(rec->key);
+	if (rec->own_plan)
+		do_set_free(rec->plan);
+	free(rec);
+}
+
+static void *
+restore_worker(
+	void *arg)
+{
+	struct restore_queue *queue = arg;
+
+	pthread_mutex_lock(&queue->lock);
+	for(;;) {
+		struct restore_record *rec, *waiting, **pos;
+		struct restore_wait *wait;
+		int status;
+
+		while (!queue->ready && !(queue->done && !queue->in_flight))
+			pthread_cond_wait(&queue->ready_cond, &queue->lock);
+		rec = queue->ready;
+		if (!rec)
+			break;
+		queue->ready = rec->next;
+		if (!queue->ready)
+			queue->ready_tail = &queue->ready;
+		pthread_mutex_unlock(&queue->lock);
+
+		status = restore_file(rec->path_p, rec->line, rec->uid,
+				      rec->gid, rec->flags, rec->plan,
+				      rec->memo);
+
+		pthread_mutex_lock(&queue->lock);
+		if (status)
+			queue->status = 1;
+		pos = &queue->latest[rec->hash % RESTORE_QUEUE_SIZE];
+		while (*pos && *pos != rec)
+			pos = &(*pos)->hash_next;
+		if (*pos)
+			*pos = rec->hash_next;
+		restore_count_below(queue, rec->key, -1);
+		while ((waiting = rec->waiting)) {
+			rec->waiting = waiting->next;
+			restore_unblock(queue, waiting);
+		}
+		while ((wait = rec->waiters)) {
+			rec->waiters = wait->next;
+			restore_unblock(queue, wait->rec);
+			free(wait);
+		}
+		if (queue->ready)
+			pthread_cond_broadcast(&queue->ready_cond);
+		queue->in_flight--;
+		pthread_cond_signal(&queue->room_cond);
+		if (queue->done && !queue->in_flight)
+			pthread_cond_broadcast(&queue->ready_cond);
+		restore_free_record(rec);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	do_set_release();
+	restore_dirs_release();
+	return NULL;
+}
+
+static struct restore_queue *
+restore_start(
+	int jobs)
+{
+	struct restore_queue *queue;
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return NULL;
+	queue->threads = malloc(jobs * sizeof(*queue->threads));
+	if (!queue->threads) {
+		free(queue);
+		return NULL;
+	}
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->ready_cond, NULL);
+	pthread_cond_init(&queue->room_cond, NULL);
+	queue->ready_tail = &queue->ready;
+	while (queue->num_threads < jobs &&
+	       pthread_create(&queue->threads[queue->num_threads], NULL,
+			      restore_worker, queue) == 0)
+		queue->num_threads++;
+	if (queue->num_threads == 0) {
+		free(queue->threads);
+		free(queue);
+		return NULL;
+	}
+	return queue;
+}
+
+/*
+ * Hand a record over to the worker threads. A plan with a memo table is
+ * cached, and is not freed with the record.
+ */
+static int
+restore_submit(
+	struct restore_queue *queue,
+	char *path_p,
+	int line,
+	uid_t uid,
+	gid_t gid,
+	mode_t flags,
+	struct do_set_plan *plan,
+	struct do_set_memo *memo)
+{
+	struct restore_record *rec, *depends, **pos;
+	int below;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return -1;
+	rec->key = restore_key(path_p);
+	if (!rec->key) {
+		free(rec);
+		return -1;
+	}
+	rec->hash = restore_hash(rec->key, strlen(rec->key));
+	rec->path_p = path_p;
+	rec->line = line;
+	rec->uid = uid;
+	rec->gid = gid;
+	rec->flags = flags;
+	rec->plan = plan;
+	rec->memo = memo;
+	rec->own_plan = (memo == NULL);
+	rec->waiting_tail = &rec->waiting;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->in_flight == RESTORE_QUEUE_SIZE)
+		pthread_cond_wait(&queue->room_cond, &queue->lock);
+	below = restore_wait_below(queue, rec);
+	if (below < 0) {
+		pthread_mutex_unlock(&queue->lock);
+		free(rec->key);
+		free(rec);
+		return -1;
+	}
+	rec->blocked = below;
+	depends = restore_depends(queue, rec->key);
+	pos = restore_find(queue, rec->key, strlen(rec->key), rec->hash);
+	if (*pos) {
+		/* Later records for this file wait for this one. */
+		rec->hash_next = (*pos)->hash_next;
+		(*pos)->hash_next = NULL;
+		*pos = rec;
+	} else {
+		rec->hash_next = queue->latest[rec->hash % RESTORE_QUEUE_SIZE];
+		queue->latest[rec->hash % RESTORE_QUEUE_SIZE] = rec;
+	}
+	queue->in_flight++;
+	restore_count_below(queue, rec->key, 1);
+	if (depends) {
+		*depends->waiting_tail = rec;
+		depends->waiting_tail = &rec->next;
+		rec->blocked++;
+	} else if (!rec->blocked) {
+		*queue->ready_tail = rec;
+		queue->ready_tail = &rec->next;
+		pthread_cond_signal(&queue->ready_cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
+
+/* Wait until all records are restored, and return the status. */
+static int
+restore_finish(
+	struct restore_queue *queue)
+{
+	int status;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->done = 1;
+	pthread_cond_broadcast(&queue->ready_cond);
+	pthread_mutex_unlock(&queue->lock);
+	while (queue->num_threads)
+		pthread_join(queue->threads[--queue->num_threads], NULL);
+	status = queue->status;
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->ready_cond);
+	pthread_cond_destroy(&queue->room_cond);
+	free(queue->threads);
+	free(queue);
+	return status;
+}
+
+
+/* Number of distinct ACLs remembered in a restore, and hash buckets */
+#define RESTORE_CACHE_SIZE	1024
+
+/*
+ * In a backup, the same ACL text repeats for many files. Each distinct
+ * text is parsed and compiled once; files which start out with the same
+ * ACLs then get their new ACLs from the memo table of the plan. With
+ * --serve, the commands of requests are cached in the same way.
+ */
+struct restore_acl {
+	struct restore_acl *next;
+	unsigned int hash;
+	char *text;
+	size_t size;
+	struct do_set_plan *plan;
+	struct do_set_memo *memo;
+};
+
+struct restore_cache {
+	struct restore_acl *hash[RESTORE_CACHE_SIZE];
+	size_t num_acls;
+};
+
+static struct restore_acl *
+restore_cache_find(
+	struct restore_cache *cache,
+	const char *text,
+	size_t size,
+	unsigned int hash)
+{
+	struct restore_acl *acl;
+
+	for (acl = cache->hash[hash % RESTORE_CACHE_SIZE]; acl;
+	     acl = acl->next)
+		if (acl->hash == hash && acl->size == size &&
+		    memcmp(acl->text, text, size) == 0)
+			break;
+	return acl;
+}
+
+/*
+ * Remember the plan for an ACL text. The cache then owns the plan. The
+ * cache is only an optimization, so NULL is returned on errors.
+ */
+static struct restore_acl *
+restore_cache_add(
+	struct restore_cache *cache,
+	const char *text,
+	size_t size,
+	unsigned int hash,
+	struct do_set_plan *plan)
+{
+	struct restore_acl *acl;
+
+	if (cache->num_acls == RESTORE_CACHE_SIZE)
+		return NULL;
+	acl = malloc(sizeof(*acl) + size);
+	if (!acl)
+		return NULL;
+	acl->memo = do_set_memo_create();
+	if (!acl->memo) {
+		free(acl);
+		return NULL;
+	}
+	acl->hash = hash;
+	acl->text = (char *)(acl + 1);
+	memcpy(acl->text, text, size);
+	acl->size = size;
+	acl->plan = plan;
+	acl->next = cache->hash[hash % RESTORE_CACHE_SIZE];
+	cache->hash[hash % RESTORE_CACHE_SIZE] = acl;
+	cache->num_acls++;
+	return acl;
+}
+
+static void
+restore_cache_free(
+	struct restore_cache *cache)
+{
+	struct restore_acl *acl;
+	size_t n;
+
+	if (!cache)
+		return;
+	for (n = 0; n < RESTORE_CACHE_SIZE; n++) {
+		while ((acl = cache->hash[n])) {
+			cache->hash[n] = acl->next;
+			do_set_memo_free(acl->memo);
+			do_set_free(acl->plan);
+			free(acl);
+		}
+	}
+	free(cache);
+}
+
+
 int
 restore(
 	FILE *file,
 	const char *filename)
 {
-	char *path_p;
-	struct stat st;
+	struct restore_queue *queue = NULL;
+	struct restore_cache *cache = NULL;
+	struct restore_acl *acl;
+	struct acl_input *input, *text_input;
+	struct do_set_plan *plan = NULL;
+	char *path_p = NULL;
+	const char *text;
+	size_t size;
+	unsigned int hash;
 	uid_t uid;
 	gid_t gid;
-	mode_t mask, flags;
-	struct do_set_args args = { };
-	int line = 0, backup_line;
+	mode_t flags;
+	seq_t seq = NULL;
+	int line = 0, backup_line, acl_line, lines, path_line = 0;
 	int error, status = 0;
-	int chmod_required = 0;
+	int same_as;
+
+	input = acl_input_open(file);
+	if (!input) {
+		error = errno;
+		pthread_mutex_lock(&output_lock);
+		fprintf(stderr, "%s: %s: %s\n", progname,
+			xquote(filename, "\n\r"), strerror(error));
+		pthread_mutex_unlock(&output_lock);
+		return 1;
+	}
 
-	memset(&st, 0, sizeof(st));
+	/* In test mode, the resulting ACLs are listed in order. */
+	if (opt_jobs > 1 && !opt_test)
+		queue = restore_start(opt_jobs);
+	if (!(cache = calloc(1, sizeof(*cache))))
+		goto fail_errno;
 
 	for(;;) {
 		backup_line = line;
-		error = read_acl_comments(file, &line, &path_p, &uid, &gid,
-					  &flags);
+		error = read_acl_comments(input, &line, &path_p, &path_line,
+					  &uid, &gid, &flags, &same_as);
 		if (error < 0) {
 			error = -error;
 			goto fail;
 		}
 		if (error == 0)
-			return status;
+			goto getout;
 
 		if (path_p == NULL) {
+			pthread_mutex_lock(&output_lock);
 			if (filename) {
 				fprintf(stderr, _("%s: %s: No filename found "
 						  "in line %d, aborting\n"),
@@ -155,110 +959,335 @@ restore(
 						 "aborting\n"),
 					progname, backup_line);
 			}
+			pthread_mutex_unlock(&output_lock);
 			status = 1;
 			goto getout;
 		}
 
-		if (!(args.seq = seq_init()))
-			goto fail_errno;
-		if (seq_append_cmd(args.seq, CMD_REMOVE_ACL, ACL_TYPE_ACCESS) ||
-		    seq_append_cmd(args.seq, CMD_REMOVE_ACL, ACL_TYPE_DEFAULT))
-			goto fail_errno;
-
-		error = read_acl_seq(file, args.seq, CMD_ENTRY_REPLACE,
-		                     SEQ_PARSE_WITH_PERM |
-				     SEQ_PARSE_DEFAULT |
-				     SEQ_PARSE_MULTI,
-				     &line, NULL);
-		if (error != 0) {
-			fprintf(stderr, _("%s: %s: %s in line %d\n"),
-			        progname, xquote(filename, "\n\r"), strerror(errno),
-				line);
-			status = 1;
-			goto getout;
-		}
-
-		error = stat(path_p, &st);
-		if (opt_test && error != 0) {
-			fprintf(stderr, "%s: %s: %s\n", progname,
-				xquote(path_p, "\n\r"), strerror(errno));
-			status = 1;
-		}
-
-		args.mode = 0;
-		error = do_set(path_p, &st, 0, &args);
-		if (error != 0) {
-			status = 1;
+		/* Hard links share their ACLs with the first link. */
+		if (same_as)
 			goto resume;
-		}
-
-		if (uid != ACL_UNDEFINED_ID && uid != st.st_uid)
-			st.st_uid = uid;
-		else
-			st.st_uid = -1;
-		if (gid != ACL_UNDEFINED_ID && gid != st.st_gid)
-			st.st_gid = gid;
-		else
-			st.st_gid = -1;
-		if (!opt_test &&
-		    (st.st_uid != -1 || st.st_gid != -1)) {
-			if (chown(path_p, st.st_uid, st.st_gid) != 0) {
-				fprintf(stderr, _("%s: %s: Cannot change "
-					          "owner/group: %s\n"),
-					progname, xquote(path_p, "\n\r"),
-					strerror(errno));
-				status = 1;
-			}
-
-			/* chown() clears setuid/setgid so force a chmod if
-			 * S_ISUID/S_ISGID was expected */
-			if ((st.st_mode & flags) & (S_ISUID | S_ISGID))
-				chmod_required = 1;
-		}
 
-		mask = S_ISUID | S_ISGID | S_ISVTX;
-		if (chmod_required || ((st.st_mode & mask) != (flags & mask))) {
-			if (!args.mode)
-				args.mode = st.st_mode;
-			args.mode &= (S_IRWXU | S_IRWXG | S_IRWXO);
-			if (chmod(path_p, flags | args.mode) != 0) {
-				fprintf(stderr, _("%s: %s: Cannot change "
-					          "mode: %s\n"),
-					progname, xquote(path_p, "\n\r"),
-					strerror(errno));
+		acl_line = line;
+		lines = read_acl_text(input, &text, &size);
+		if (lines < 0)
+			goto fail_errno;
+		hash = restore_hash(text, size);
+		acl = restore_cache_find(cache, text, size, hash);
+		if (!acl) {
+			/* The commands of the previous entry are reused. */
+			if (seq)
+				seq_reset(seq);
+			else if (!(seq = seq_init()))
+				goto fail_errno;
+			if (seq_append_cmd(seq, CMD_REMOVE_ACL,
+					   ACL_TYPE_ACCESS) ||
+			    seq_append_cmd(seq, CMD_REMOVE_ACL,
+					   ACL_TYPE_DEFAULT))
+				goto fail_errno;
+
+			if (!(text_input = acl_input_text(text, size)))
+				goto fail_errno;
+			error = read_acl_seq(text_input, seq, CMD_ENTRY_REPLACE,
+					     SEQ_PARSE_WITH_PERM |
+					     SEQ_PARSE_DEFAULT |
+					     SEQ_PARSE_MULTI,
+					     &line, NULL);
+			acl_input_close(text_input);
+			if (error != 0) {
+				pthread_mutex_lock(&output_lock);
+				fprintf(stderr, _("%s: %s: %s in line %d\n"),
+					progname, xquote(filename, "\n\r"),
+					strerror(errno), line);
+				pthread_mutex_unlock(&output_lock);
 				status = 1;
+				goto getout;
 			}
+			if (!(plan = do_set_compile(seq)))
+				goto fail_errno;
+			acl = restore_cache_add(cache, text, size, hash, plan);
+			if (acl)
+				plan = NULL;  /* owned by the cache */
 		}
+		line = acl_line + lines;
+
+		if (queue) {
+			if (restore_submit(queue, path_p, path_line, uid,
+					   gid, flags,
+					   acl ? acl->plan : plan,
+					   acl ? acl->memo : NULL) != 0)
+				goto fail_errno;
+			path_p = NULL;
+			plan = NULL;
+		} else if (restore_file(path_p, 0, uid, gid, flags,
+					acl ? acl->plan : plan,
+					acl ? acl->memo : NULL) != 0)
+			status = 1;
 resume:
 		if (path_p) {
 			free(path_p);
 			path_p = NULL;
 		}
-		if (args.seq) {
-			seq_free(args.seq);
-			args.seq = NULL;
-		}
+		do_set_free(plan);
+		plan = NULL;
 	}
 
 getout:
+	if (queue && restore_finish(queue) != 0)
+		status = 1;
+	restore_cache_free(cache);
+	restore_dirs_release();
 	if (path_p) {
 		free(path_p);
 		path_p = NULL;
 	}
-	if (args.seq) {
-		seq_free(args.seq);
-		args.seq = NULL;
+	if (seq) {
+		seq_free(seq);
+		seq = NULL;
 	}
+	do_set_free(plan);
+	plan = NULL;
+	acl_input_close(input);
 	return status;
 
 fail_errno:
 	error = errno;
 fail:
+	pthread_mutex_lock(&output_lock);
 	fprintf(stderr, "%s: %s: %s\n", progname, xquote(filename, "\n\r"),
 		strerror(error));
+	pthread_mutex_unlock(&output_lock);
 	status = 1;
 	goto getout;
 }
+
+
+/*
+ * Parse the commands of a --serve request into seq. The commands are the
+ * same as on the command line, but ACLs cannot be read from files.
+ */
+static int
+serve_parse(
+	seq_t seq,
+	int argc,
+	char *argv[])
+{
+	cmd_t remove_acl_cmd, remove_default_acl_cmd;
+	int n, which, seq_cmd, parse_mode;
+	const char *opt;
+
+	for (n = 0; n < argc; n++) {
+		opt = argv[n];
+		remove_acl_cmd = remove_default_acl_cmd = NULL;
+		if (!strcmp(opt, "-b") || !strcmp(opt, "--remove-all")) {
+			if (seq_append_cmd(seq, CMD_REMOVE_EXTENDED_ACL,
+						ACL_TYPE_ACCESS) ||
+			    seq_append_cmd(seq, CMD_REMOVE_ACL,
+						ACL_TYPE_DEFAULT))
+				goto fail_errno;
+			continue;
+		}
+		if (!strcmp(opt, "-k") || !strcmp(opt, "--remove-default")) {
+			if (seq_append_cmd(seq, CMD_REMOVE_ACL,
+						ACL_TYPE_DEFAULT))
+				goto fail_errno;
+			continue;
+		}
+
+		if (!strcmp(opt, "-s") || !strcmp(opt, "--set")) {
+			if (seq_append_cmd(seq, CMD_REMOVE_ACL,
+						ACL_TYPE_ACCESS))
+				goto fail_errno;
+			remove_acl_cmd = seq->s_last;
+			if (seq_append_cmd(seq, CMD_REMOVE_ACL,
+						ACL_TYPE_DEFAULT))
+				goto fail_errno;
+			remove_default_acl_cmd = seq->s_last;
+			seq_cmd = CMD_ENTRY_REPLACE;
+			parse_mode = SEQ_PARSE_WITH_PERM;
+		} else if (!strcmp(opt, "-m") || !strcmp(opt, "--modify")) {
+			seq_cmd = CMD_ENTRY_REPLACE;
+			parse_mode = SEQ_PARSE_WITH_PERM;
+		} else if (!strcmp(opt, "-x") || !strcmp(opt, "--remove")) {
+			seq_cmd = CMD_REMOVE_ENTRY;
+			parse_mode = posixly_correct ? SEQ_PARSE_ANY_PERM :
+						       SEQ_PARSE_NO_PERM;
+		} else {
+			fprintf(stderr, _("%s: Unknown command %s\n"),
+				progname, xquote(opt, "\n\r"));
+			return -1;
+		}
+		if (++n == argc) {
+			fprintf(stderr, _("%s: Option %s incomplete\n"),
+				progname, opt);
+			return -1;
+		}
+		if (!posixly_correct)
+			parse_mode |= SEQ_PARSE_DEFAULT;
+		if (opt_promote)
+			parse_mode |= SEQ_PROMOTE_ACL;
+		if (parse_acl_seq(seq, argv[n], &which, seq_cmd,
+				  parse_mode) != 0) {
+			if (which < 0 || (size_t) which >= strlen(argv[n]))
+				fprintf(stderr, _("%s: Option %s incomplete\n"),
+					progname, opt);
+			else
+				fprintf(stderr, _("%s: Option %s: %s near "
+					"character %d\n"), progname, opt,
+					strerror(errno), which+1);
+			return -1;
+		}
+		if (remove_acl_cmd &&
+		    !has_any_of_type(remove_acl_cmd->c_next, ACL_TYPE_ACCESS))
+			seq_delete_cmd(seq, remove_acl_cmd);
+		if (remove_default_acl_cmd &&
+		    !has_any_of_type(remove_default_acl_cmd->c_next,
+				     ACL_TYPE_DEFAULT))
+			seq_delete_cmd(seq, remove_default_acl_cmd);
+	}
+	return 0;
+
+fail_errno:
+	fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+	return -1;
+}
+
+
+/* Commands of a --serve request which take an argument */
+static int
+serve_takes_arg(
+	const char *opt)
+{
+	return !strcmp(opt, "-s") || !strcmp(opt, "--set") ||
+	       !strcmp(opt, "-m") || !strcmp(opt, "--modify") ||
+	       !strcmp(opt, "-x") || !strcmp(opt, "--remove");
+}
+
+
+/*
+ * Serve one --serve request: commands, optionally followed by "--", and
+ * the files to apply them to. Returns the exit status setfacl would have
+ * for the same command line.
+ */
+static int
+serve_setfacl(
+	int argc,
+	char *argv[],
+	void *arg)
+{
+	static char *key;
+	static size_t key_size;
+	struct restore_cache *cache = arg;
+	struct restore_acl *acl;
+	struct do_set_args args;
+	struct do_set_plan *plan = NULL;
+	size_t size = 0, len;
+	unsigned int hash;
+	int n, cmds, errors = 0;
+	seq_t seq;
+
+	/* The commands, which are the key in the cache */
+	for (cmds = 0; cmds < argc; cmds++) {
+		if (argv[cmds][0] != '-' || !strcmp(argv[cmds], "--"))
+			break;
+		len = strlen(argv[cmds]) + 1;
+		if (high_water_alloc((void **)&key, &key_size, size + len)) {
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			return 1;
+		}
+		memcpy(key + size, argv[cmds], len);
+		size += len;
+		if (serve_takes_arg(argv[cmds]) && cmds + 1 < argc) {
+			cmds++;
+			len = strlen(argv[cmds]) + 1;
+			if (high_water_alloc((void **)&key, &key_size,
+					     size + len)) {
+				fprintf(stderr, "%s: %s\n", progname,
+					strerror(errno));
+				return 1;
+			}
+			memcpy(key + size, argv[cmds], len);
+			size += len;
+		}
+	}
+	n = cmds;
+	if (n < argc && !strcmp(argv[n], "--"))
+		n++;
+	if (cmds == 0 || n == argc) {
+		fprintf(stderr, _("%s: Request without commands or files\n"),
+			progname);
+		return 2;
+	}
+
+	hash = restore_hash(key, size);
+	acl = restore_cache_find(cache, key, size, hash);
+	if (!acl) {
+		seq = seq_init();
+		if (!seq) {
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			return 1;
+		}
+		if (serve_parse(seq, cmds, argv) != 0) {
+			seq_free(seq);
+			return 2;
+		}
+		plan = do_set_compile(seq);
+		seq_free(seq);
+		if (!plan) {
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			return 1;
+		}
+		acl = restore_cache_add(cache, key, size, hash, plan);
+		if (acl)
+			plan = NULL;
+	}
+
+	args.plan = acl ? acl->plan : plan;
+	args.reference = NULL;
+	args.minimize = NULL;
+	args.links = NULL;
+	if ((walk_flags & WALK_TREE_RECURSIVE) && !opt_test)
+		args.links = inode_set_create(0);
+	args.memo = acl ? acl->memo : NULL;
+	args.fd = -1;
+	args.name = NULL;
+	for (; n < argc; n++)
+		if (walk_tree(argv[n], walk_flags, 0, do_set, &args))
+			errors = 1;
+	inode_set_free(args.links);
+	do_set_free(plan);
+	return errors;
+}
+
+
+/*
+ * Serve requests from standard input, or from the Unix domain socket
+ * socket_path.
+ */
+static int
+serve_requests(
+	const char *socket_path)
+{
+	struct restore_cache *cache;
+	int status = 0;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		return 1;
+	}
+	if (serve(socket_path, serve_setfacl, cache) != 0) {
+		if (socket_path)
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				xquote(socket_path, "\n\r"), strerror(errno));
+		else
+			fprintf(stderr, _("%s: Standard input: %s\n"),
+				progname, strerror(errno));
+		status = 1;
+	}
+	restore_cache_free(cache);
+	return status;
+}
 #endif
 
 
@@ -280,6 +1309,8 @@ void help(void)
 		printf(_(
 "      --set=acl           set the ACL of file(s), replacing the current ACL\n"
 "      --set-file=file     read ACL entries to set from file\n"
+"      --reference=file    copy the ACLs of file\n"
+"      --minimize          remove redundant access ACL entries\n"
 "      --mask              do recalculate the effective rights mask\n"));
 	}
 #endif
@@ -292,8 +1323,18 @@ void help(void)
 "  -R, --recursive         recurse into subdirectories\n"
 "  -L, --logical           logical walk, follow symbolic links\n"
 "  -P, --physical          physical walk, do not follow symbolic links\n"
+"      --one-file-system   do not cross file system boundaries\n"
+"      --exclude=PATTERN   skip files matching PATTERN\n"
+"      --exclude-from=FILE skip files matching any pattern in FILE\n"
+"      --type=d|f          only modify directories or regular files\n"
+"      --max-depth=N       descend at most N levels below the arguments\n"
+"      --files-from=FILE   also modify the files named in FILE\n"
+"  -0, --null              file names in FILE are separated by null\n"
+"                          characters instead of newlines\n"
 "      --restore=file      restore ACLs (inverse of `getfacl -R')\n"
-"      --test              test mode (ACLs are not modified)\n"));
+"      --jobs=N            restore and process file lists using N threads\n"
+"      --test              test mode (ACLs are not modified)\n"
+"      --serve[=SOCKET]    serve requests from standard input or SOCKET\n"));
 	}
 #endif
 	printf(_(
@@ -302,25 +1343,248 @@ void help(void)
 }
 
 
-int next_file(const char *arg, seq_t seq)
+/* Number of listed names read ahead of the worker threads */
+#define NAMES_QUEUE_SIZE	1024
+
+/*
+ * The names of a file list waiting to be walked by the worker threads
+ * of --jobs. The walks share the plan, memo table and hard linked files
+ * of the sequence, and run in no particular order.
+ */
+struct names_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t ready_cond, room_cond;
+	char *names[NAMES_QUEUE_SIZE];
+	size_t first, count;
+	int done;
+	int errors;
+	const struct do_set_args *args;
+	struct do_set_minimize minimize;
+	pthread_t *threads;
+	int num_threads;
+};
+
+static void *names_worker(void *arg)
 {
-	char *line;
+	struct names_queue *queue = arg;
+	struct do_set_args args = *queue->args;
+	struct do_set_minimize minimize = { 0, 0 };
 	int errors = 0;
-	struct do_set_args args;
+	char *name;
+
+	if (args.minimize)
+		args.minimize = &minimize;
+	pthread_mutex_lock(&queue->lock);
+	for(;;) {
+		while (!queue->count && !queue->done)
+			pthread_cond_wait(&queue->ready_cond, &queue->lock);
+		if (!queue->count)
+			break;
+		name = queue->names[queue->first];
+		queue->first = (queue->first + 1) % NAMES_QUEUE_SIZE;
+		queue->count--;
+		pthread_cond_signal(&queue->room_cond);
+		pthread_mutex_unlock(&queue->lock);
+
+		if (walk_tree(name, walk_flags, 0, do_set, &args))
+			errors = 1;
+		free(name);
+
+		pthread_mutex_lock(&queue->lock);
+	}
+	if (errors)
+		queue->errors = 1;
+	queue->minimize.files += minimize.files;
+	queue->minimize.saved += minimize.saved;
+	pthread_mutex_unlock(&queue->lock);
+	do_set_release();
+	return NULL;
+}
+
+static struct names_queue *names_start(int jobs,
+				       const struct do_set_args *args)
+{
+	struct names_queue *queue;
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return NULL;
+	queue->threads = malloc(jobs * sizeof(*queue->threads));
+	if (!queue->threads) {
+		free(queue);
+		return NULL;
+	}
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->ready_cond, NULL);
+	pthread_cond_init(&queue->room_cond, NULL);
+	queue->args = args;
+	while (queue->num_threads < jobs &&
+	       pthread_create(&queue->threads[queue->num_threads], NULL,
+			      names_worker, queue) == 0)
+		queue->num_threads++;
+	if (queue->num_threads == 0) {
+		pthread_mutex_destroy(&queue->lock);
+		pthread_cond_destroy(&queue->ready_cond);
+		pthread_cond_destroy(&queue->room_cond);
+		free(queue->threads);
+		free(queue);
+		return NULL;
+	}
+	return queue;
+}
 
-	args.seq = seq;
+/* Hand a copy of a name over to the worker threads. */
+static int names_submit(struct names_queue *queue, const char *name)
+{
+	char *copy = strdup(name);
+
+	if (!copy)
+		return -1;
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == NAMES_QUEUE_SIZE)
+		pthread_cond_wait(&queue->room_cond, &queue->lock);
+	queue->names[(queue->first + queue->count) % NAMES_QUEUE_SIZE] = copy;
+	queue->count++;
+	pthread_cond_signal(&queue->ready_cond);
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
 
-	if (strcmp(arg, "-") == 0) {
-		while ((line = next_line(stdin)))
-			errors = walk_tree(line, walk_flags, 0, do_set, &args);
-		if (!feof(stdin)) {
+/* Wait until all names are walked, and return whether any walk failed. */
+static int names_finish(struct names_queue *queue, struct do_set_args *args)
+{
+	int errors;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->done = 1;
+	pthread_cond_broadcast(&queue->ready_cond);
+	pthread_mutex_unlock(&queue->lock);
+	while (queue->num_threads)
+		pthread_join(queue->threads[--queue->num_threads], NULL);
+	errors = queue->errors;
+	if (args->minimize) {
+		args->minimize->files += queue->minimize.files;
+		args->minimize->saved += queue->minimize.saved;
+	}
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->ready_cond);
+	pthread_cond_destroy(&queue->room_cond);
+	free(queue->threads);
+	free(queue);
+	return errors;
+}
+
+/*
+ * Apply the command sequence to the files named in LIST, which is called
+ * LIST_NAME in error messages, or is standard input. With --jobs, the
+ * files are walked in several threads, except in test mode.
+ */
+static int walk_names(FILE *list, const char *list_name,
+		      struct do_set_args *args)
+{
+	struct names_queue *queue = NULL;
+	char *name;
+	int errors = 0, read_error, error;
+
+	if (opt_jobs > 1 && !opt_test)
+		queue = names_start(opt_jobs, args);
+	while ((name = next_name(list, opt_null))) {
+		if (*name == '\0')
+			continue;
+		if (queue && names_submit(queue, name) == 0)
+			continue;
+		if (walk_tree(name, walk_flags, 0, do_set, args))
+			errors = 1;
+	}
+	read_error = !feof(list);
+	error = errno;
+	if (queue && names_finish(queue, args))
+		errors = 1;
+	if (read_error) {
+		if (list_name)
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				xquote(list_name, "\n\r"), strerror(error));
+		else
 			fprintf(stderr, _("%s: Standard input: %s\n"),
-				progname, strerror(errno));
+				progname, strerror(error));
+		errors = 1;
+	}
+	return errors;
+}
+
+
+/*
+ * The compiled plan of the current command sequence, the memo table of its
+ * results, and the hard linked files already done, set up once at its
+ * first file and kept until the sequence is reset, so that all files of
+ * the sequence share them.
+ */
+static struct do_set_args file_args = { .fd = -1 };
+static int files_started;
+
+static int start_files(seq_t seq)
+{
+	if (files_started)
+		return 0;
+	if (!reference && !opt_minimize) {
+		file_args.plan = do_set_compile(seq);
+		if (!file_args.plan) {
+			fprintf(stderr, "%s: %s\n", progname,
+				strerror(errno));
+			return 1;
+		}
+		file_args.memo = do_set_memo_create();
+	}
+	if ((walk_flags & WALK_TREE_RECURSIVE) && !opt_test)
+		file_args.links = inode_set_create(0);
+	files_started = 1;
+	return 0;
+}
+
+static void end_files(void)
+{
+	inode_set_free(file_args.links);
+	file_args.links = NULL;
+	do_set_memo_free(file_args.memo);
+	file_args.memo = NULL;
+	do_set_free(file_args.plan);
+	file_args.plan = NULL;
+	files_started = 0;
+}
+
+/*
+ * Apply the command sequence to a file argument, or to the files named
+ * in a list if LIST is set. A file or list of "-" stands for standard
+ * input. All files are processed with the same compiled sequence.
+ */
+int next_file(const char *arg, int list, const struct do_set_args *files)
+{
+	FILE *file;
+	int errors = 0;
+	struct do_set_args args = *files;
+	struct do_set_minimize minimize = { 0, 0 };
+
+	args.reference = reference;
+	args.minimize = opt_minimize ? &minimize : NULL;
+
+	if (strcmp(arg, "-") == 0)
+		errors = walk_names(stdin, NULL, &args);
+	else if (list) {
+		file = fopen(arg, "r");
+		if (file) {
+			errors = walk_names(file, arg, &args);
+			fclose(file);
+		} else {
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				xquote(arg, "\n\r"), strerror(errno));
 			errors = 1;
 		}
 	} else {
 		errors = walk_tree(arg, walk_flags, 0, do_set, &args);
 	}
+	if (opt_minimize && opt_test)
+		printf(_("%s: %llu bytes saved in %lu file(s)\n"),
+		       xquote(arg, "\n\r"), minimize.saved, minimize.files);
 	return errors ? 1 : 0;
 }
 
@@ -335,11 +1599,13 @@ int main(int argc, char *argv[])
 	int saw_files = 0;
 	int status = 0;
 	FILE *file;
+	struct acl_input *input;
 	int which;
 	int lineno;
 	int error;
 	seq_t seq;
 	int seq_cmd, parse_mode;
+	char *p;
 	
 	progname = basename(argv[0]);
 
@@ -375,10 +1641,14 @@ int main(int argc, char *argv[])
 		cmd_t seq_remove_acl_cmd = NULL;
 
 		if (opt != '\1' && saw_files) {
+			end_files();
 			seq_free(seq);
 			seq = seq_init();
 			if (!seq)
 				ERRNO_ERROR(1);
+			do_set_reference_free(reference);
+			reference = NULL;
+			opt_minimize = 0;
 			saw_files = 0;
 		}
 
@@ -518,9 +1788,15 @@ int main(int argc, char *argv[])
 				}
 
 				lineno = 0;
-				error = read_acl_seq(file, seq, seq_cmd,
-				                     parse_mode, &lineno, NULL);
-				
+				input = acl_input_open(file);
+				if (input) {
+					error = read_acl_seq(input, seq, seq_cmd,
+							     parse_mode, &lineno,
+							     NULL);
+					acl_input_close(input);
+				} else
+					error = -1;
+
 				if (file != stdin) {
 					fclose(file);
 				}
@@ -552,11 +1828,33 @@ int main(int argc, char *argv[])
 
 
 			case '\1':  /* file argument */
-				if (seq_empty(seq))
+				if (seq_empty(seq) && !reference &&
+				    !opt_minimize)
+					goto synopsis;
+				if (start_files(seq) != 0) {
+					status = 1;
+					goto cleanup;
+				}
+				saw_files = 1;
+
+				status = next_file(optarg, 0, &file_args);
+				break;
+
+			case 'F':  /* list of file arguments */
+				if (seq_empty(seq) && !reference &&
+				    !opt_minimize)
 					goto synopsis;
+				if (start_files(seq) != 0) {
+					status = 1;
+					goto cleanup;
+				}
 				saw_files = 1;
 
-				status = next_file(optarg, seq);
+				status = next_file(optarg, 1, &file_args);
+				break;
+
+			case '0':  /* null separated file names */
+				opt_null = 1;
 				break;
 
 			case 'B':  /* restore ACL backup */
@@ -585,6 +1883,34 @@ int main(int argc, char *argv[])
 					goto cleanup;
 				break;
 
+			case 'E':  /* copy the ACLs of a reference file */
+				if (reference || opt_minimize)
+					goto synopsis;
+				reference = do_set_reference_read(optarg);
+				if (!reference) {
+					fprintf(stderr, "%s: %s: %s\n",
+						progname,
+						xquote(optarg, "\n\r"),
+						strerror(errno));
+					status = 2;
+					goto cleanup;
+				}
+				break;
+
+			case 'Z':  /* minimize access ACLs */
+				if (reference)
+					goto synopsis;
+				opt_minimize = 1;
+				break;
+
+			case 'V':  /* serve requests */
+				saw_files = 1;
+
+				status = serve_requests(optarg);
+				if (status != 0)
+					goto cleanup;
+				break;
+
 			case 'R':  /* recursive */
 				walk_flags |= WALK_TREE_RECURSIVE;
 				break;
@@ -604,6 +1930,32 @@ int main(int argc, char *argv[])
 				opt_test = 1;
 				break;
 
+			case 'j':  /* threads for restoring and file lists */
+				opt_jobs = strtol(optarg, &p, 10);
+				if (*p != '\0' || opt_jobs < 1) {
+					fprintf(stderr, "%s: %s: %s\n",
+						progname, xquote(optarg, "\n\r"),
+						strerror(EINVAL));
+					status = 2;
+					goto cleanup;
+				}
+				break;
+
+			case WALK_TREE_OPT_ONE_FILESYSTEM:
+			case WALK_TREE_OPT_EXCLUDE:
+			case WALK_TREE_OPT_EXCLUDE_FROM:
+			case WALK_TREE_OPT_TYPE:
+			case WALK_TREE_OPT_MAX_DEPTH:
+				if (walk_tree_option(opt, optarg,
+						     &walk_flags) != 0) {
+					fprintf(stderr, "%s: %s: %s\n",
+						progname, xquote(optarg, "\n\r"),
+						strerror(errno));
+					status = 2;
+					goto cleanup;
+				}
+				break;
+
 			case 'v':  /* print version and exit */
 				printf("%s " VERSION "\n", progname);
 				status = 0;
@@ -627,6 +1979,8 @@ int main(int argc, char *argv[])
 				            ACL_TYPE_ACCESS))
 				seq_delete_cmd(seq, seq_remove_acl_cmd);
 		}
+		if ((reference || opt_minimize) && !seq_empty(seq))
+			goto synopsis;
 		if (seq_remove_default_acl_cmd) {
 			/* This was a set operation. Check if there are
 			   actually entries of ACL_TYPE_DEFAULT; if there
@@ -639,11 +1993,15 @@ int main(int argc, char *argv[])
 	while (optind < argc) {
 		if(!seq)
 			goto synopsis;
-		if (seq_empty(seq))
+		if (seq_empty(seq) && !reference && !opt_minimize)
 			goto synopsis;
+		if (start_files(seq) != 0) {
+			status = 1;
+			goto cleanup;
+		}
 		saw_files = 1;
 
-		status = next_file(argv[optind++], seq);
+		status = next_file(argv[optind++], 0, &file_args);
 	}
 	if (!saw_files)
 		goto synopsis;
@@ -663,8 +2021,10 @@ errno_error:
 	goto cleanup;
 
 cleanup:
+	end_files();
 	if (seq)
 		seq_free(seq);
+	do_set_reference_free(reference);
 	return status;
 }
 
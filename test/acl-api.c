@@ -0,0 +1,282 @@
+/*
+  File: acl-api.c
+  (Exercise libacl extensions from the test scripts)
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or (at
+  your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <sys/acl.h>
+#include <acl/libacl.h>
+#include <attr/error_context.h>
+
+static const char *progname = "acl-api";
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: %s get-files [-d] [-q] [-C dir] sync|threads|uring file ...\n"
+"       %s set-files [-q] [-C dir] sync|threads|uring acl file ...\n"
+"       %s copy-tree [-L] [-x] [-j jobs] src dst\n"
+"       %s cache [-f] size file[=acl] ...\n",
+		progname, progname, progname, progname);
+	exit(2);
+}
+
+static void print_acl(const char *name, acl_t acl)
+{
+	char *text;
+
+	text = acl_to_any_text(acl, NULL, ',', TEXT_ABBREVIATE);
+	printf("%s: %s\n", name, text ? text : strerror(errno));
+	acl_free(text);
+}
+
+static int parse_engine(const char *arg)
+{
+	if (strcmp(arg, "sync") == 0)
+		return ACL_BATCH_SYNC;
+	if (strcmp(arg, "threads") == 0)
+		return ACL_BATCH_THREADS;
+	if (strcmp(arg, "uring") == 0)
+		return ACL_BATCH_URING;
+	usage();
+	return -1;
+}
+
+/*
+ * get-files and set-files: run one batch over the files, and print the
+ * result of each item (only of the failed ones with -q), followed by
+ * the number of items that failed.
+ */
+static int batch(int argc, char *argv[], int set)
+{
+	struct acl_batch *items;
+	acl_type_t type = ACL_TYPE_ACCESS;
+	int dirfd = AT_FDCWD, quiet = 0;
+	int engine, failed, opt, n, count;
+	acl_t acl = NULL;
+
+	while ((opt = getopt(argc, argv, "dqC:")) != -1) {
+		switch(opt) {
+			case 'd':
+				type = ACL_TYPE_DEFAULT;
+				break;
+			case 'q':
+				quiet = 1;
+				break;
+			case 'C':
+				dirfd = open(optarg, O_RDONLY | O_DIRECTORY);
+				if (dirfd < 0) {
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				usage();
+		}
+	}
+	if (argc - optind < 1 + set)
+		usage();
+	engine = parse_engine(argv[optind++]);
+	if (set) {
+		acl = acl_from_text(argv[optind]);
+		if (!acl) {
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				argv[optind], strerror(errno));
+			return 1;
+		}
+		optind++;
+	}
+
+	count = argc - optind;
+	items = calloc(count ? count : 1, sizeof(*items));
+	if (!items) {
+		perror(progname);
+		return 1;
+	}
+	for (n = 0; n < count; n++) {
+		items[n].dirfd = dirfd;
+		items[n].path_p = argv[optind + n];
+		items[n].type = type;
+		items[n].acl = acl;
+	}
+
+	if (set)
+		failed = acl_set_files(items, count, engine);
+	else
+		failed = acl_get_files(items, count, engine);
+	if (failed < 0) {
+		perror(progname);
+		return 1;
+	}
+	for (n = 0; n < count; n++) {
+		if (items[n].error)
+			printf("%s: %s\n", items[n].path_p,
+			       strerror(items[n].error));
+		else if (!quiet) {
+			if (set)
+				printf("%s: ok\n", items[n].path_p);
+			else
+				print_acl(items[n].path_p, items[n].acl);
+		}
+		if (!set && items[n].acl)
+			acl_free(items[n].acl);
+	}
+	printf("%d failed\n", failed);
+	if (acl)
+		acl_free(acl);
+	free(items);
+	return 0;
+}
+
+static void print_error(struct error_context *ctx, const char *fmt, ...)
+{
+	int saved_errno = errno;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("%s%s\n", *fmt ? ": " : "", strerror(saved_errno));
+}
+
+/*
+ * copy-tree: copy the permissions of a tree with perm_copy_tree(), and
+ * print the errors reported through the error context.
+ */
+static int copy_tree(int argc, char *argv[])
+{
+	struct error_context ctx = { .error = print_error };
+	int flags = 0, jobs = 0, opt;
+
+	while ((opt = getopt(argc, argv, "Lxj:")) != -1) {
+		switch(opt) {
+			case 'L':
+				flags |= PERM_COPY_TREE_LOGICAL;
+				break;
+			case 'x':
+				flags |= PERM_COPY_TREE_ONE_FILESYSTEM;
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+			default:
+				usage();
+		}
+	}
+	if (argc - optind != 2)
+		usage();
+	if (perm_copy_tree(argv[optind], argv[optind + 1], flags, jobs,
+			   &ctx) != 0) {
+		printf("failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * cache: look up the ACLs of the files in the order given in one cache,
+ * and print whether each lookup was a hit. An argument of the form
+ * file=acl sets the ACL of the file instead. The ACLs returned are
+ * modified after printing them, which must not affect the cache.
+ */
+static int cache(int argc, char *argv[])
+{
+	struct acl_cache *cache;
+	unsigned long hits, misses, last_hits = 0;
+	int use_fd = 0, opt, n;
+
+	while ((opt = getopt(argc, argv, "f")) != -1) {
+		switch(opt) {
+			case 'f':
+				use_fd = 1;
+				break;
+			default:
+				usage();
+		}
+	}
+	if (argc - optind < 1)
+		usage();
+	cache = acl_cache_create(atoi(argv[optind++]));
+	if (!cache) {
+		perror(progname);
+		return 1;
+	}
+	for (n = optind; n < argc; n++) {
+		char *path = argv[n], *text = strchr(path, '=');
+		acl_entry_t entry;
+		acl_t acl;
+
+		if (text) {
+			*text++ = '\0';
+			acl = acl_from_text(text);
+			if (!acl || acl_set_file(path, ACL_TYPE_ACCESS, acl) != 0)
+				printf("%s: %s\n", path, strerror(errno));
+			acl_free(acl);
+			continue;
+		}
+		if (use_fd) {
+			int fd = open(path, O_RDONLY);
+
+			acl = NULL;
+			if (fd >= 0) {
+				acl = acl_cache_get_fd(cache, fd, NULL);
+				close(fd);
+			}
+		} else
+			acl = acl_cache_get(cache, path, ACL_TYPE_ACCESS, NULL);
+		if (!acl) {
+			printf("%s: %s\n", path, strerror(errno));
+			continue;
+		}
+		acl_cache_stats(cache, &hits, NULL);
+		text = acl_to_any_text(acl, NULL, ',', TEXT_ABBREVIATE);
+		printf("%s: %s (%s)\n", path, text ? text : strerror(errno),
+		       hits != last_hits ? "hit" : "miss");
+		acl_free(text);
+		last_hits = hits;
+		if (acl_get_entry(acl, ACL_FIRST_ENTRY, &entry) == 1)
+			acl_delete_entry(acl, entry);
+		acl_free(acl);
+	}
+	acl_cache_stats(cache, &hits, &misses);
+	printf("%lu hits, %lu misses\n", hits, misses);
+	acl_cache_destroy(cache);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+		usage();
+	if (strcmp(argv[1], "get-files") == 0)
+		return batch(argc - 1, argv + 1, 0);
+	if (strcmp(argv[1], "set-files") == 0)
+		return batch(argc - 1, argv + 1, 1);
+	if (strcmp(argv[1], "copy-tree") == 0)
+		return copy_tree(argc - 1, argv + 1);
+	if (strcmp(argv[1], "cache") == 0)
+		return cache(argc - 1, argv + 1);
+	usage();
+	return 2;
+}